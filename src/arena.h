@@ -0,0 +1,110 @@
+// copyright 2018 john howard (orthopteroid@gmail.com)
+// MIT license
+//
+// A single-block bump allocator for runtime-sized solver storage.
+// Every allocation is cache-line aligned and large blocks are mmap'd and advised for hugepages.
+//
+// Usage is two-pass: alloc() on an unreserved arena only measures, so the same layout routine
+// can be run once to size the block and once more to carve it up.
+//
+//   Arena sizing;
+//   layout(sizing);
+//   arena.reserve(sizing.used);
+//   layout(arena);
+
+#ifndef PSYCHICSNIFFLE_ARENA_H
+#define PSYCHICSNIFFLE_ARENA_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <sys/mman.h>
+
+#include "instrument.h"
+
+namespace util {
+
+const size_t CacheLine = 64;
+const size_t HugePage = 2 << 20;
+
+inline size_t alignUp(size_t n, size_t a = CacheLine) { return (n + a - 1) & ~(a - 1); }
+
+inline void *alignedAlloc(size_t bytes)
+{
+    void *p = 0;
+    if (posix_memalign(&p, CacheLine, alignUp(bytes)))
+        throw new std::runtime_error("aligned allocation failed");
+    SNIFFLE_ALLOC(alignUp(bytes));
+    return p;
+}
+
+inline void alignedFree(void *p) { free(p); }
+
+struct Arena
+{
+    uint8_t *base = 0;
+    size_t capacity = 0;
+    size_t used = 0;
+
+    // mmap bookkeeping, when the block is hugepage sized
+    void *mapping = 0;
+    size_t mappingSize = 0;
+
+    Arena() {}
+    Arena( const Arena& other ) = delete;
+    Arena& operator=( Arena& other ) = delete;
+    Arena& operator=( const Arena& other ) = delete;
+
+    virtual ~Arena() { release(); }
+
+    // Returns cache-line aligned storage for n T's, or null when only sizing.
+    template<typename T>
+    T *alloc(size_t n)
+    {
+        size_t offset = used;
+        used += alignUp(n * sizeof(T));
+        if (!base) return 0;
+        if (used > capacity)
+            throw new std::runtime_error("arena overflow");
+        return (T *) (base + offset);
+    }
+
+    void reserve(size_t bytes)
+    {
+        release();
+        capacity = alignUp(bytes);
+        if (capacity >= HugePage) {
+            // over-map so the block can start on a hugepage boundary
+            mappingSize = alignUp(capacity, HugePage) + HugePage;
+            mapping = mmap(0, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapping == MAP_FAILED) {
+                mapping = 0;
+                throw new std::runtime_error("arena mmap failed");
+            }
+            SNIFFLE_ALLOC(mappingSize);
+            base = (uint8_t *) alignUp((size_t) mapping, HugePage);
+#ifdef MADV_HUGEPAGE
+            madvise(base, alignUp(capacity, HugePage), MADV_HUGEPAGE);
+#endif
+        } else {
+            base = (uint8_t *) alignedAlloc(capacity);
+        }
+        used = 0;
+    }
+
+    void release()
+    {
+        if (mapping)
+            munmap(mapping, mappingSize);
+        else if (base)
+            alignedFree(base);
+        mapping = 0;
+        mappingSize = 0;
+        base = 0;
+        capacity = used = 0;
+    }
+};
+
+}
+
+#endif //PSYCHICSNIFFLE_ARENA_H
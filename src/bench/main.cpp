@@ -0,0 +1,395 @@
+// copyright 2016 john howard (orthopteroid@gmail.com)
+// MIT license
+//
+// Microbenchmarks for the core kernels, in the style of (and with the flags and json layout of)
+// google-benchmark, so its tooling can compare runs. No dependency on it though.
+//
+// usage: sniffle_bench [--benchmark_filter=substring] [--benchmark_min_time=seconds]
+//                      [--benchmark_format=console|json|csv]
+//
+// Shapes follow the apps: a 4 byte float (quadratic), 36 bytes (hydro, 12 steps of 3 unit-ops)
+// and 40 bytes (schwefel, 20 16-bit genes), at populations of 400, 500 and 60000.
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <functional>
+#include <memory>
+
+#include "sniffle.h"
+
+using namespace sniffle;
+
+//////////////////////////////
+
+template<typename T>
+inline void doNotOptimize(T const &v) { asm volatile("" : : "g"(&v) : "memory"); }
+
+inline uint64_t cpuNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// A benchmark is registered as a setup function which returns the body to time.
+// The body runs the kernel the given number of times; setup is only paid for benchmarks that run.
+typedef std::function<void(uint64_t)> Body;
+
+struct Benchmark
+{
+    std::string name;
+    std::function<Body()> setup;
+};
+
+struct Result
+{
+    std::string name;
+    uint64_t iterations;
+    double realNs, cpuNs; // per iteration
+};
+
+std::vector<Benchmark> &registry()
+{
+    static std::vector<Benchmark> r;
+    return r;
+}
+
+void add(const std::string &name, std::function<Body()> setup) { registry().push_back({name, setup}); }
+
+// grows the iteration count until a run takes at least minTime, like google-benchmark
+Result run(const Benchmark &b, double minTime)
+{
+    Body body = b.setup();
+    body(1); // warm up
+
+    uint64_t iterations = 1;
+    while (true) {
+        const uint64_t r0 = nowNs(), c0 = cpuNs();
+        body(iterations);
+        const uint64_t real = nowNs() - r0, cpu = cpuNs() - c0;
+
+        const double seconds = real * 1e-9;
+        if (seconds >= minTime || iterations >= 1000000000ull)
+            return {b.name, iterations, (double) real / iterations, (double) cpu / iterations};
+
+        // aim 40% past the minimum, growing by at most 10x
+        double multiplier = seconds > 0 ? minTime * 1.4 / seconds : 10.;
+        multiplier = std::min(10., std::max(multiplier, 1.5));
+        iterations = (uint64_t) (iterations * multiplier) + 1;
+    }
+}
+
+//////////////////////////////
+// kernels
+
+const uint StateSizes[] = {4, 36, 40};
+const uint Populations[] = {400, 500, 60000};
+
+std::string shape(uint stateSize, uint population) { return std::to_string(stateSize) + "/" + std::to_string(population); }
+
+void fillRandom(uint8_t *p, size_t n)
+{
+    for (size_t i = 0; i < n; i++) p[i] = (uint8_t) rand();
+}
+
+struct Rand
+{
+    Taus88State state;
+    std::unique_ptr<Taus88> taus88;
+
+    Rand() { state.seed(1ULL); taus88.reset(new Taus88(state)); }
+};
+
+void registerTaus88()
+{
+    add("taus88/next", []() -> Body {
+        auto r = std::make_shared<Rand>();
+        return [r](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) { uint32_t v = (*r->taus88)(); doNotOptimize(v); }
+        };
+    });
+    add("taus88/bounded/60000", []() -> Body {
+        auto r = std::make_shared<Rand>();
+        return [r](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) { uint32_t v = r->taus88->bounded(60000); doNotOptimize(v); }
+        };
+    });
+    add("taus88/fill/1024", []() -> Body {
+        auto r = std::make_shared<Rand>();
+        auto out = std::make_shared<std::vector<uint32_t>>(1024);
+        return [r, out](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) { r->taus88->fill(out->data(), 1024); doNotOptimize(out->front()); }
+        };
+    });
+}
+
+// the weighted sampler over the population (the old buildSamplerTable), and the per-channel byte sampler
+template<typename IT, typename VT>
+struct AliasFixture
+{
+    Arena arena;
+    AliasTable<IT> table;
+    VT *in;
+    IT *work;
+
+    AliasFixture(uint n)
+    {
+        Arena sizing;
+        layout(sizing, n);
+        arena.reserve(sizing.used);
+        layout(arena, n);
+        for (uint i = 0; i < n; i++) in[i] = (VT) (rand() % 1000);
+    }
+
+    void layout(Arena &a, uint n)
+    {
+        table.layout(a, n);
+        in = a.alloc<VT>(n);
+        work = a.alloc<IT>(n);
+    }
+};
+
+void registerAlias()
+{
+    add("alias/build/256", []() -> Body {
+        auto f = std::make_shared<AliasFixture<uint8_t, uint8_t>>(256);
+        return [f](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) { f->table.build(f->in, f->work); doNotOptimize(f->table.prob[0]); }
+        };
+    });
+    for (uint pop : Populations) {
+        add("alias/build/" + std::to_string(pop), [pop]() -> Body {
+            auto f = std::make_shared<AliasFixture<uint32_t, float_t>>(pop);
+            return [f](uint64_t n) {
+                for (uint64_t i = 0; i < n; i++) { f->table.build(f->in, f->work); doNotOptimize(f->table.prob[0]); }
+            };
+        });
+    }
+    add("alias/sample/60000", []() -> Body {
+        auto f = std::make_shared<AliasFixture<uint32_t, float_t>>(60000);
+        f->table.build(f->in, f->work);
+        auto r = std::make_shared<Rand>();
+        return [f, r](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) { uint v = f->table.sample(*r->taus88); doNotOptimize(v); }
+        };
+    });
+}
+
+template<uint Size>
+void registerSplice()
+{
+    add("splice/" + std::to_string(Size), []() -> Body {
+        auto buf = std::make_shared<std::vector<uint8_t>>(3 * Size);
+        fillRandom(buf->data(), buf->size());
+        auto r = std::make_shared<Rand>();
+        return [buf, r](uint64_t n) {
+            uint8_t *a = buf->data(), *b = a + Size, *out = b + Size;
+            for (uint64_t i = 0; i < n; i++) { splice<Size>(out, a, b, (*r->taus88)()); doNotOptimize(out[0]); }
+        };
+    });
+}
+
+void registerNSelector()
+{
+    for (uint pop : Populations) {
+        add("nselector/select2/" + std::to_string(pop), [pop]() -> Body {
+            auto f = std::make_shared<AliasFixture<uint32_t, float_t>>(pop);
+            f->table.build(f->in, f->work);
+            auto r = std::make_shared<Rand>();
+            auto sel = std::make_shared<NSelector<2>>(pop);
+            return [f, r, sel](uint64_t n) {
+                for (uint64_t i = 0; i < n; i++) {
+                    sel->reset();
+                    uint a = sel->select(*r->taus88, f->table);
+                    uint b = sel->select(*r->taus88, f->table);
+                    doNotOptimize(a);
+                    doNotOptimize(b);
+                }
+            };
+        });
+    }
+}
+
+// the analyser cranked over a random population with the maximizer's elite sample count
+struct AnalyserFixture
+{
+    Arena arena;
+    ByteAnalyser analyser;
+    uint8_t *state;
+    int *elites;
+    uint eliteSamples;
+
+    AnalyserFixture(uint stateSize, uint population)
+    {
+        eliteSamples = 5 + (uint) (population * .50) * .05;
+        Arena sizing;
+        layout(sizing, stateSize, population);
+        arena.reserve(sizing.used);
+        layout(arena, stateSize, population);
+
+        fillRandom(state, (size_t) stateSize * population);
+        for (uint i = 0; i < eliteSamples; i++) elites[i] = rand() % population;
+        analyser.reset();
+    }
+
+    void layout(Arena &a, uint stateSize, uint population)
+    {
+        analyser.layout(a, stateSize);
+        state = a.alloc<uint8_t>((size_t) stateSize * population);
+        elites = a.alloc<int>(eliteSamples);
+    }
+};
+
+void registerAnalyser()
+{
+    for (uint ss : StateSizes)
+        for (uint pop : Populations)
+            add("byteanalyser/crank/" + shape(ss, pop), [ss, pop]() -> Body {
+                auto f = std::make_shared<AnalyserFixture>(ss, pop);
+                return [f](uint64_t n) {
+                    for (uint64_t i = 0; i < n; i++) f->analyser.crank(f->state, f->elites, f->eliteSamples);
+                };
+            });
+}
+
+// crank() clobbers the fitness it is given, so each crank gets a fresh copy of one evaluation
+struct MaximizerFixture
+{
+    DynamicMaximizer<ByteAnalyser> solver;
+    std::vector<float_t> fitness;
+
+    MaximizerFixture(uint stateSize, uint population) : solver(population, stateSize), fitness(population)
+    {
+        solver.seed(1);
+        solver.reset();
+        const uint n = stateSize;
+        float_t *e = solver.evaluate([n](uint8_t *p) -> float_t {
+            float_t s = 0;
+            for (uint i = 0; i < n; i++) s += p[i];
+            return s;
+        });
+        std::copy(e, e + population, fitness.begin());
+    }
+};
+
+void registerMaximizer()
+{
+    for (uint ss : StateSizes)
+        for (uint pop : Populations)
+            add("maximizer/crank/" + shape(ss, pop), [ss, pop]() -> Body {
+                auto f = std::make_shared<MaximizerFixture>(ss, pop);
+                return [f](uint64_t n) {
+                    for (uint64_t i = 0; i < n; i++) {
+                        std::copy(f->fitness.begin(), f->fitness.end(), f->solver.e);
+                        f->solver.crank();
+                    }
+                };
+            });
+}
+
+//////////////////////////////
+// reporting
+
+void reportConsoleHeader() { printf("%-36s %14s %14s %12s\n", "Benchmark", "Time", "CPU", "Iterations"); }
+
+void reportConsole(const Result &r)
+{
+    printf("%-36s %11.1f ns %11.1f ns %12llu\n", r.name.c_str(), r.realNs, r.cpuNs, (unsigned long long) r.iterations);
+    fflush(stdout);
+}
+
+void reportCsv(const std::vector<Result> &results)
+{
+    printf("name,iterations,real_time,cpu_time,time_unit\n");
+    for (const Result &r : results)
+        printf("\"%s\",%llu,%.3f,%.3f,ns\n", r.name.c_str(), (unsigned long long) r.iterations, r.realNs, r.cpuNs);
+}
+
+void reportJson(const std::vector<Result> &results, const char *executable)
+{
+    char date[64];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+
+    printf("{\n  \"context\": {\n");
+    printf("    \"date\": \"%s\",\n", date);
+    printf("    \"executable\": \"%s\",\n", executable);
+#ifdef _OPENMP
+    printf("    \"num_cpus\": %d,\n", omp_get_num_procs());
+    printf("    \"num_threads\": %d,\n", omp_get_max_threads());
+#else
+    printf("    \"num_cpus\": 1,\n");
+    printf("    \"num_threads\": 1,\n");
+#endif
+    printf("    \"taus88_lanes\": %d,\n", Taus88Lanes);
+#if defined(NDEBUG)
+    printf("    \"library_build_type\": \"release\"\n");
+#else
+    printf("    \"library_build_type\": \"debug\"\n");
+#endif
+    printf("  },\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &r = results[i];
+        printf("    {\n");
+        printf("      \"name\": \"%s\",\n", r.name.c_str());
+        printf("      \"run_name\": \"%s\",\n", r.name.c_str());
+        printf("      \"run_type\": \"iteration\",\n");
+        printf("      \"iterations\": %llu,\n", (unsigned long long) r.iterations);
+        printf("      \"real_time\": %.3f,\n", r.realNs);
+        printf("      \"cpu_time\": %.3f,\n", r.cpuNs);
+        printf("      \"time_unit\": \"ns\"\n");
+        printf("    }%s\n", i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+//////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    std::string filter, format = "console";
+    double minTime = 0.5;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 19, "--benchmark_filter=") == 0)
+            filter = arg.substr(19);
+        else if (arg.compare(0, 21, "--benchmark_min_time=") == 0)
+            minTime = atof(arg.substr(21).c_str());
+        else if (arg.compare(0, 19, "--benchmark_format=") == 0)
+            format = arg.substr(19);
+        else {
+            fprintf(stderr, "usage: %s [--benchmark_filter=substring] [--benchmark_min_time=seconds] "
+                            "[--benchmark_format=console|json|csv]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    srand(1);
+
+    registerTaus88();
+    registerAlias();
+    registerSplice<4>();
+    registerSplice<36>();
+    registerSplice<40>();
+    registerNSelector();
+    registerAnalyser();
+    registerMaximizer();
+
+    std::vector<Result> results;
+    if (format == "console") reportConsoleHeader();
+    for (const Benchmark &b : registry()) {
+        if (!filter.empty() && b.name.find(filter) == std::string::npos) continue;
+        results.push_back(run(b, minTime));
+        if (format == "console") reportConsole(results.back());
+    }
+
+    if (format == "json")
+        reportJson(results, argv[0]);
+    else if (format == "csv")
+        reportCsv(results);
+
+    return 0;
+}
@@ -0,0 +1,230 @@
+// copyright 2016 john howard (orthopteroid@gmail.com)
+// MIT license
+//
+// Byte-distribution kernels for the state analysers, a channel at a time. A channel is 256 bytes for
+// the ByteAnalyser and one byte per value (or bin) of a field for the FieldAnalyser.
+// Every update is a saturating byte op so it maps onto psubusb/paddusb and friends.
+//
+// Elite amplification is accumulated into delta slabs with saturating adds. Saturating addition
+// of non-negative values is associative and commutative, so slabs can be filled in any order
+// (or by any number of threads) and merge to the same result.
+//
+// A channel's sampler is only rebuilt once the channel has drifted far enough from the snapshot
+// it was built from, measured with psadbw.
+
+#ifndef PSYCHICSNIFFLE_BYTEDISTR_H
+#define PSYCHICSNIFFLE_BYTEDISTR_H
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+
+namespace util {
+
+const uint8_t DistrAmplifyBelow = 250; // amplification only applies to bytes below this
+const uint8_t DistrAmplifyCap = 254;   // ...and never takes them past this
+
+inline void negateBytes(uint8_t *d, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i ones = _mm256_set1_epi8(-1);
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((__m256i *) (d + i));
+        _mm256_storeu_si256((__m256i *) (d + i), _mm256_xor_si256(v, ones));
+    }
+#elif defined(__SSE2__)
+    const __m128i ones = _mm_set1_epi8(-1);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((__m128i *) (d + i));
+        _mm_storeu_si128((__m128i *) (d + i), _mm_xor_si128(v, ones));
+    }
+#endif
+    for (; i < n; i++) d[i] = ~d[i];
+}
+
+// elite value b gets +5 and, unless the channel is categorical, its neighbours within 3 get +1
+inline void amplifyDelta(uint8_t *delta, int b, int n = 256, bool categorical = false)
+{
+    delta[b] = delta[b] > 255 - 5 ? 255 : delta[b] + 5;
+    if (categorical) return;
+
+    // slightly distribute locality
+    for (int bo = 1; bo < 4; bo++) {
+        if (b - bo >= 0 && delta[b - bo] < 255) delta[b - bo]++;
+        if (b + bo < n && delta[b + bo] < 255) delta[b + bo]++;
+    }
+}
+
+// One generation of an n byte channel:
+// undo a negation (optionally), attenuate everything above 1 by 1, then merge the delta slabs
+// (slabStride bytes apart) and amplify the bytes below DistrAmplifyBelow. The slabs are cleared for the next round.
+inline void updateChannel(uint8_t *d, uint8_t *delta, size_t slabStride, uint slabs, bool unnegate, int n = 256)
+{
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256i flip = _mm256_set1_epi8(unnegate ? -1 : 0);
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i below = _mm256_set1_epi8(DistrAmplifyBelow - 1);
+    const __m256i cap = _mm256_set1_epi8((char) DistrAmplifyCap);
+    const __m256i zero = _mm256_setzero_si256();
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((__m256i *) (d + i)), flip);
+        v = _mm256_max_epu8(_mm256_subs_epu8(v, one), _mm256_min_epu8(v, one));
+
+        __m256i sum = zero;
+        for (uint s = 0; s < slabs; s++) {
+            __m256i *p = (__m256i *) (delta + s * slabStride + i);
+            sum = _mm256_adds_epu8(sum, _mm256_loadu_si256(p));
+            _mm256_storeu_si256(p, zero);
+        }
+
+        __m256i amp = _mm256_min_epu8(_mm256_adds_epu8(v, sum), cap);
+        __m256i mask = _mm256_cmpeq_epi8(_mm256_min_epu8(v, below), v);
+        _mm256_storeu_si256((__m256i *) (d + i), _mm256_blendv_epi8(v, amp, mask));
+    }
+#elif defined(__SSE2__)
+    const __m128i flip = _mm_set1_epi8(unnegate ? -1 : 0);
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i below = _mm_set1_epi8(DistrAmplifyBelow - 1);
+    const __m128i cap = _mm_set1_epi8((char) DistrAmplifyCap);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((__m128i *) (d + i)), flip);
+        v = _mm_max_epu8(_mm_subs_epu8(v, one), _mm_min_epu8(v, one));
+
+        __m128i sum = zero;
+        for (uint s = 0; s < slabs; s++) {
+            __m128i *p = (__m128i *) (delta + s * slabStride + i);
+            sum = _mm_adds_epu8(sum, _mm_loadu_si128(p));
+            _mm_storeu_si128(p, zero);
+        }
+
+        __m128i amp = _mm_min_epu8(_mm_adds_epu8(v, sum), cap);
+        __m128i mask = _mm_cmpeq_epi8(_mm_min_epu8(v, below), v);
+        _mm_storeu_si128((__m128i *) (d + i), _mm_or_si128(_mm_and_si128(mask, amp), _mm_andnot_si128(mask, v)));
+    }
+#endif
+    for (; i < n; i++) {
+        uint8_t v = unnegate ? ~d[i] : d[i];
+        if (v > 1) v -= 1;
+
+        uint sum = 0;
+        for (uint s = 0; s < slabs; s++) {
+            sum += delta[s * slabStride + i];
+            delta[s * slabStride + i] = 0;
+        }
+
+        if (v < DistrAmplifyBelow) v = (uint8_t) std::min<uint>(v + sum, DistrAmplifyCap);
+        d[i] = v;
+    }
+}
+
+inline void channelRange(const uint8_t *d, uint8_t &min, uint8_t &max, int n = 256)
+{
+    int i = 0;
+    min = 255;
+    max = 0;
+#if defined(__SSE2__)
+    if (n >= 16) {
+        __m128i lo = _mm_loadu_si128((__m128i *) d), hi = lo;
+        for (i = 16; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128((__m128i *) (d + i));
+            lo = _mm_min_epu8(lo, v);
+            hi = _mm_max_epu8(hi, v);
+        }
+        lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 8));
+        hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 8));
+        lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 4));
+        hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 4));
+        lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 2));
+        hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 2));
+        lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 1));
+        hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 1));
+        min = (uint8_t) _mm_cvtsi128_si32(lo);
+        max = (uint8_t) _mm_cvtsi128_si32(hi);
+    }
+#endif
+    for (; i < n; i++) {
+        min = std::min(min, d[i]);
+        max = std::max(max, d[i]);
+    }
+}
+
+// L1 distance between a channel, less its minimum, and a snapshot taken the same way.
+// Also returns the byte sum of the channel, from which the sampler's area follows.
+inline uint channelDrift(const uint8_t *d, uint8_t min, const uint8_t *snapshot, uint &sum, int n = 256)
+{
+    int i = 0;
+    uint drift = 0;
+    sum = 0;
+#if defined(__SSE2__)
+    const __m128i vmin = _mm_set1_epi8((char) min), zero = _mm_setzero_si128();
+    __m128i vdrift = zero, vsum = zero;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((__m128i *) (d + i));
+        __m128i r = _mm_subs_epu8(v, vmin);
+        vdrift = _mm_add_epi64(vdrift, _mm_sad_epu8(r, _mm_loadu_si128((__m128i *) (snapshot + i))));
+        vsum = _mm_add_epi64(vsum, _mm_sad_epu8(v, zero));
+    }
+    drift = (uint) (_mm_cvtsi128_si32(vdrift) + _mm_cvtsi128_si32(_mm_srli_si128(vdrift, 8)));
+    sum = (uint) (_mm_cvtsi128_si32(vsum) + _mm_cvtsi128_si32(_mm_srli_si128(vsum, 8)));
+#endif
+    for (; i < n; i++) {
+        int r = d[i] - min;
+        drift += std::abs(r - snapshot[i]);
+        sum += d[i];
+    }
+    return drift;
+}
+
+// Entropy of a snapshot (a channel less its minimum) with the given area, normalized so a uniform
+// channel is 1. x*log2(x) is tabled for byte values.
+inline float_t channelEntropy(const uint8_t *snapshot, uint area, int n = 256)
+{
+    struct XLogX {
+        float_t t[256];
+        XLogX() { t[0] = 0; for (int x = 1; x < 256; x++) t[x] = x * std::log2((float_t) x); }
+    };
+    static const XLogX xlogx;
+
+    if (area == 0 || n < 2) return 1;
+    float_t sum = 0;
+    for (int i = 0; i < n; i++) sum += xlogx.t[snapshot[i]];
+    const float_t h = std::log2((float_t) area) - sum / area;
+    return h / std::log2((float_t) n);
+}
+
+// Smallest difference between one channel's max and any channel's min, over 255.
+// When every max is at least every min this is (min of the maxima) - (max of the minima), otherwise
+// some differences wrap (as they always have) and the pairs are searched.
+inline float_t smallestChannelDifference(const uint8_t *min, const uint8_t *max, uint channels)
+{
+    uint8_t minMax = 255, maxMin = 0;
+    for (uint c = 0; c < channels; c++) {
+        minMax = std::min(minMax, max[c]);
+        maxMin = std::max(maxMin, min[c]);
+    }
+    if (minMax >= maxMin)
+        return (float_t) (minMax - maxMin) / 255.f;
+
+    uint8_t deltaE = (uint8_t) ~0;
+    for (uint c1 = 0; c1 < channels; c1++)
+        for (uint c2 = 0; c2 < channels; c2++)
+            deltaE = std::min(deltaE, (uint8_t) (max[c1] - min[c2]));
+    return (float_t) deltaE / 255.f;
+}
+
+inline void channelSnapshot(uint8_t *snapshot, const uint8_t *d, uint8_t min, int n = 256)
+{
+    for (int i = 0; i < n; i++) snapshot[i] = d[i] - min;
+}
+
+}
+
+#endif //PSYCHICSNIFFLE_BYTEDISTR_H
@@ -0,0 +1,359 @@
+// copyright 2016 john howard (orthopteroid@gmail.com)
+// MIT license
+//
+// Convergence benchmark: evaluations-to-epsilon over a suite of test functions, repeated over seeds.
+// Evaluations are what a real problem pays for, so this is the number to judge crank and group
+// changes by. Seeded runs are identical at any thread count, so only wall time changes with threads;
+// given several thread counts, the benchmark checks this and fails if any seed's evaluations differ.
+// With --require-solved it also fails if any seed is left unsolved. That is how steady-state and
+// island runs are checked, as they don't repeat.
+//
+// usage: sniffle_converge [--functions=a,b] [--seeds=N] [--threads=1,2,4] [--dim=D] [--population=P]
+//                         [--budget=evaluations] [--epsilon=e] [--analyser=field|byte] [--format=console|json]
+//                         [--islands=K] [--migrate=generations] [--topology=ring|biring|full] [--steady]
+//                         [--require-solved]
+//
+// With islands, each island has the given population and the thread count is shared among them.
+// Evaluations are then summed over the islands, and seeded runs no longer repeat exactly.
+// --steady uses the steady-state solver, which doesn't repeat exactly either.
+//
+// Genes are 16-bit fixed point over each function's domain (as schwefel), except quadratic which
+// is a float (as the quadratic app). Functions are minimized to 0, by maximizing their negation.
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "sniffle.h"
+#include "islands.h"
+
+using namespace sniffle;
+
+//////////////////////////////
+
+struct TestFunction
+{
+    const char *name;
+    float_t lo, hi;   // domain of each 16-bit gene
+    float_t epsilon;  // solved when within this of the minimum
+    bool fixedDim;    // quadratic is 1-d and float-coded
+    float_t (*f)(const float_t *x, uint dim);
+};
+
+float_t schwefel(const float_t *x, uint dim)
+{
+    float_t sum = 0;
+    for (uint d = 0; d < dim; d++) sum += x[d] * sinf(sqrtf(fabsf(x[d])));
+    return 418.9829f * dim - sum;
+}
+
+float_t rastrigin(const float_t *x, uint dim)
+{
+    float_t sum = 10.f * dim;
+    for (uint d = 0; d < dim; d++) sum += x[d] * x[d] - 10.f * cosf(2.f * (float_t) M_PI * x[d]);
+    return sum;
+}
+
+float_t rosenbrock(const float_t *x, uint dim)
+{
+    float_t sum = 0;
+    for (uint d = 0; d + 1 < dim; d++) {
+        const float_t a = x[d + 1] - x[d] * x[d], b = 1.f - x[d];
+        sum += 100.f * a * a + b * b;
+    }
+    return sum;
+}
+
+float_t ackley(const float_t *x, uint dim)
+{
+    float_t sq = 0, cs = 0;
+    for (uint d = 0; d < dim; d++) {
+        sq += x[d] * x[d];
+        cs += cosf(2.f * (float_t) M_PI * x[d]);
+    }
+    return -20.f * expf(-.2f * sqrtf(sq / dim)) - expf(cs / dim) + 20.f + (float_t) M_E;
+}
+
+float_t griewank(const float_t *x, uint dim)
+{
+    float_t sum = 0, prod = 1;
+    for (uint d = 0; d < dim; d++) {
+        sum += x[d] * x[d];
+        prod *= cosf(x[d] / sqrtf((float_t) d + 1));
+    }
+    return 1.f + sum / 4000.f - prod;
+}
+
+// the quadratic app's gaussian peak, as a distance in percent from its mean.
+// capped, so the fitness samplers never see an infinity.
+float_t quadratic(const float_t *x, uint)
+{
+    const float_t mu = 101.10101f, cap = 1e6f;
+    return std::isfinite(x[0]) ? std::min(cap, 100.f * fabsf(mu - x[0]) / mu) : cap;
+}
+
+const TestFunction Suite[] = {
+    {"schwefel", -500.f, 500.f, .1f, false, schwefel},
+    {"rastrigin", -5.12f, 5.12f, .01f, false, rastrigin},
+    {"rosenbrock", -2.048f, 2.048f, .1f, false, rosenbrock},
+    {"ackley", -32.768f, 32.768f, .01f, false, ackley},
+    {"griewank", -600.f, 600.f, .01f, false, griewank},
+    {"quadratic", 0, 0, .01f, true, quadratic},
+};
+
+//////////////////////////////
+
+struct Options
+{
+    std::vector<std::string> functions;
+    uint seeds = 11;
+    std::vector<int> threads;
+    uint dim = 20;
+    uint population = 400;
+    uint64_t budget = 2000000;
+    float_t epsilon = 0; // 0 is each function's own
+    std::string analyser = "field";
+    std::string format = "console";
+    uint islands = 1;
+    uint migrate = 20;
+    std::string topology = "ring";
+    bool steady = false;
+    bool requireSolved = false;
+};
+
+struct Run
+{
+    bool solved;
+    uint64_t evaluations;
+    double wallMs;
+};
+
+template<typename StateAnalyser>
+Run solve(const TestFunction &fn, const Options &o, int threads, uint64_t seed, const StateAnalyser &prototype)
+{
+    const uint dim = fn.fixedDim ? 1 : o.dim;
+    const uint stateSize = fn.fixedDim ? sizeof(float) : dim * sizeof(uint16_t);
+    const float_t epsilon = o.epsilon > 0 ? o.epsilon : fn.epsilon;
+
+    auto fnEval = [&](uint8_t *p) -> float_t {
+        float_t x[64];
+        if (fn.fixedDim) {
+            memcpy(x, p, sizeof(float));
+        } else {
+            for (uint d = 0; d < dim; d++) {
+                uint16_t g;
+                memcpy(&g, p + d * sizeof(uint16_t), sizeof(g));
+                x[d] = fn.lo + (fn.hi - fn.lo) * (float_t) g / 65535.f;
+            }
+        }
+        return -fn.f(x, dim);
+    };
+
+    const uint64_t t0 = nowNs();
+    if (o.islands > 1) {
+        Islands<StateAnalyser> islands(o.islands, o.population, stateSize, prototype);
+        islands.threadsPerIsland = std::max(1, threads / (int) o.islands);
+        islands.Interval = o.migrate;
+        islands.connect(o.topology == "full" ? Islands<StateAnalyser>::Full :
+                        o.topology == "biring" ? Islands<StateAnalyser>::BiRing : Islands<StateAnalyser>::Ring);
+        islands.seed(seed);
+        islands.reset();
+
+        std::atomic<uint64_t> evaluations(0);
+        std::atomic<bool> solved(false);
+        islands.solve(fnEval, [&](int, uint, float_t *f) -> bool {
+            const uint64_t n = evaluations.fetch_add(o.population) + o.population;
+            bool hit = false;
+            for (uint i = 0; i < o.population && !hit; i++) hit = f[i] >= -epsilon;
+            if (hit) solved = true;
+            return hit || n >= o.budget;
+        });
+        return {solved, evaluations, (nowNs() - t0) / 1e6};
+    }
+
+    DynamicMaximizer<StateAnalyser> solver(o.population, stateSize, prototype);
+    solver.seed(seed);
+    solver.reset();
+
+    if (o.steady) {
+        bool solved = false;
+        uint64_t evaluations = solver.solveSteady(fnEval, [&](uint t, float_t *f) -> bool {
+            solved = f[0] >= -epsilon; // the best is kept at 0
+            return solved || (uint64_t) (t + 1) * o.population >= o.budget;
+        });
+        return {solved, evaluations, (nowNs() - t0) / 1e6};
+    }
+
+    uint64_t evaluations = 0;
+    bool solved = false;
+    while (!solved && evaluations < o.budget) {
+        float_t *f = solver.evaluate(fnEval);
+        evaluations += o.population;
+        for (uint i = 0; i < o.population && !solved; i++) solved = f[i] >= -epsilon;
+        if (!solved) solver.crank();
+    }
+    return {solved, evaluations, (nowNs() - t0) / 1e6};
+}
+
+Run solve(const TestFunction &fn, const Options &o, int threads, uint64_t seed)
+{
+    if (o.analyser == "byte")
+        return solve(fn, o, threads, seed, ByteAnalyser());
+
+    const uint fields = fn.fixedDim ? 2 : o.dim;
+    FieldAnalyser schema;
+    schema.add({0, 16, false}, fields, 16);
+    return solve(fn, o, threads, seed, schema);
+}
+
+//////////////////////////////
+
+// the q'th quantile, linearly interpolated. unsolved runs sort last, as the budget.
+double quantile(std::vector<double> v, double q)
+{
+    std::sort(v.begin(), v.end());
+    const double pos = q * (v.size() - 1);
+    const size_t i = (size_t) pos;
+    return i + 1 < v.size() ? v[i] + (pos - i) * (v[i + 1] - v[i]) : v[i];
+}
+
+struct Summary
+{
+    const char *function;
+    uint dim;
+    int threads;
+    uint solved, runs;
+    double evalMedian, evalQ1, evalQ3;
+    double wallMedian;
+};
+
+std::vector<std::string> split(const std::string &s)
+{
+    std::vector<std::string> out;
+    size_t begin = 0;
+    while (begin <= s.size()) {
+        size_t end = s.find(',', begin);
+        if (end == std::string::npos) end = s.size();
+        if (end > begin) out.push_back(s.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return out;
+}
+
+int main(int argc, char *argv[])
+{
+    Options o;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string key = arg.substr(0, eq), val = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        if (key == "--functions") o.functions = split(val);
+        else if (key == "--seeds") o.seeds = (uint) atoi(val.c_str());
+        else if (key == "--threads") for (auto &t : split(val)) o.threads.push_back(atoi(t.c_str()));
+        else if (key == "--dim") o.dim = (uint) atoi(val.c_str());
+        else if (key == "--population") o.population = (uint) atoi(val.c_str());
+        else if (key == "--budget") o.budget = strtoull(val.c_str(), nullptr, 0);
+        else if (key == "--epsilon") o.epsilon = (float_t) atof(val.c_str());
+        else if (key == "--analyser") o.analyser = val;
+        else if (key == "--format") o.format = val;
+        else if (key == "--islands") o.islands = (uint) std::max(1, atoi(val.c_str()));
+        else if (key == "--migrate") o.migrate = (uint) atoi(val.c_str());
+        else if (key == "--topology") o.topology = val;
+        else if (key == "--steady") o.steady = true;
+        else if (key == "--require-solved") o.requireSolved = true;
+        else {
+            fprintf(stderr, "usage: %s [--functions=a,b] [--seeds=N] [--threads=1,2,4] [--dim=D] [--population=P]\n"
+                            "       [--budget=evaluations] [--epsilon=e] [--analyser=field|byte] [--format=console|json]\n"
+                            "       [--islands=K] [--migrate=generations] [--topology=ring|biring|full] [--steady]\n"
+                            "       [--require-solved]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (o.dim < 1 || o.dim > 64) {
+        fprintf(stderr, "dim must be 1 to 64\n");
+        return 1;
+    }
+#ifdef _OPENMP
+    if (o.threads.empty()) o.threads.push_back(omp_get_max_threads());
+#else
+    o.threads.assign(1, 1);
+#endif
+
+    const bool console = o.format != "json";
+    if (console)
+        printf("%-11s %4s %7s %7s %12s %12s %12s %12s\n",
+               "function", "dim", "threads", "solved", "evals_med", "evals_q1", "evals_q3", "wall_ms_med");
+
+    // islands and steady-state runs depend on timing, so only single solvers are checked for repeats
+    const bool repeatable = o.islands == 1 && !o.steady;
+    bool repeated = true, allSolved = true;
+
+    std::vector<Summary> summaries;
+    for (const TestFunction &fn : Suite) {
+        if (!o.functions.empty() && std::find(o.functions.begin(), o.functions.end(), fn.name) == o.functions.end())
+            continue;
+
+        std::vector<uint64_t> firstEvals; // per seed, at the first thread count
+        for (int threads : o.threads) {
+#ifdef _OPENMP
+            omp_set_num_threads(threads); // before the solver sizes its prng state
+#endif
+            std::vector<double> evals, walls;
+            uint solved = 0;
+            for (uint s = 0; s < o.seeds; s++) {
+                Run r = solve(fn, o, threads, s + 1);
+                const uint64_t evaluations = r.evaluations;
+                if (firstEvals.size() < o.seeds) {
+                    firstEvals.push_back(evaluations);
+                } else if (repeatable && firstEvals[s] != evaluations) {
+                    fprintf(stderr, "%s seed %u: %llu evaluations at %d threads, %llu at %d\n", fn.name, s + 1,
+                            (unsigned long long) evaluations, threads, (unsigned long long) firstEvals[s], o.threads[0]);
+                    repeated = false;
+                }
+                if (!r.solved && o.requireSolved) {
+                    fprintf(stderr, "%s seed %u: unsolved at %d threads after %llu evaluations\n", fn.name, s + 1,
+                            threads, (unsigned long long) r.evaluations);
+                    allSolved = false;
+                }
+                solved += r.solved;
+                evals.push_back(r.solved ? (double) r.evaluations : (double) o.budget);
+                walls.push_back(r.wallMs);
+            }
+
+            Summary sm = {fn.name, fn.fixedDim ? 1 : o.dim, threads, solved, o.seeds,
+                          quantile(evals, .5), quantile(evals, .25), quantile(evals, .75), quantile(walls, .5)};
+            summaries.push_back(sm);
+            if (console) {
+                printf("%-11s %4u %7d %3u/%-3u %12.0f %12.0f %12.0f %12.1f\n", sm.function, sm.dim, sm.threads,
+                       sm.solved, sm.runs, sm.evalMedian, sm.evalQ1, sm.evalQ3, sm.wallMedian);
+                fflush(stdout);
+            }
+        }
+    }
+
+    if (!console) {
+        printf("{\n  \"population\": %u, \"budget\": %llu, \"analyser\": \"%s\", \"islands\": %u, \"steady\": %s,\n  \"results\": [\n",
+               o.population, (unsigned long long) o.budget, o.analyser.c_str(), o.islands, o.steady ? "true" : "false");
+        for (size_t i = 0; i < summaries.size(); i++) {
+            const Summary &sm = summaries[i];
+            printf("    {\"function\": \"%s\", \"dim\": %u, \"threads\": %d, \"solved\": %u, \"runs\": %u, "
+                   "\"evaluations_median\": %.0f, \"evaluations_q1\": %.0f, \"evaluations_q3\": %.0f, \"wall_ms_median\": %.3f}%s\n",
+                   sm.function, sm.dim, sm.threads, sm.solved, sm.runs, sm.evalMedian, sm.evalQ1, sm.evalQ3, sm.wallMedian,
+                   i + 1 < summaries.size() ? "," : "");
+        }
+        printf("  ]\n}\n");
+    }
+
+    if (!repeated) {
+        fprintf(stderr, "seeded runs differ between thread counts\n");
+        return 2;
+    }
+    if (!allSolved) {
+        fprintf(stderr, "seeded runs were left unsolved\n");
+        return 3;
+    }
+    return 0;
+}
@@ -0,0 +1,393 @@
+// copyright 2016 john howard (orthopteroid@gmail.com)
+// MIT license
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hydro/basin.h"
+
+namespace hydro {
+
+using namespace std;
+
+namespace {
+
+const char Magic[8] = "SNIFBSN";
+const uint32_t Version = 1;
+
+// the walks CalcInterpolate and CalcContains make, kept inside n floats
+bool chartFits( const float *v, uint32_t n, uint32_t i )
+{
+    if( (uint64_t)i + 5 > n ) return false;
+    i += 4; // min p,h max p,h
+    while( v[i] > 0 ) // for all h
+    {
+        i++;
+        while( i < n && v[i] > 0 ) // for all p,e in h
+            i += 2;
+        if( i >= n ) return false;
+        i++;
+        if( i >= n ) return false;
+    }
+    return true;
+}
+
+bool polygonFits( const float *v, uint32_t n, uint32_t i )
+{
+    uint vertices = 0;
+    for( ; i < n && v[i] >= 0; i += 2, vertices++ )
+        if( i + 1 >= n ) return false;
+    return i < n && vertices >= 3;
+}
+
+struct Record
+{
+    uint line;
+    vector<string> tok;
+};
+
+[[noreturn]] void fail( const Record &r, const string &what )
+{
+    throw new runtime_error( "basin line " + to_string( r.line ) + ": " + what );
+}
+
+vector<Record> tokenize( const char *text )
+{
+    vector<Record> records;
+    uint line = 1;
+    for( const char *p = text; *p; line++ )
+    {
+        const char *eol = strchr( p, '\n' );
+        if( !eol ) eol = p + strlen( p );
+
+        Record r = { line, {} };
+        for( const char *q = p; q < eol && *q != '#'; )
+        {
+            if( isspace( (unsigned char)*q ) || *q == ',' ) { q++; continue; }
+            const char *b = q;
+            while( q < eol && *q != '#' && *q != ',' && !isspace( (unsigned char)*q ) ) q++;
+            r.tok.emplace_back( b, q );
+        }
+        if( !r.tok.empty() )
+        {
+            if( *p == ' ' || *p == '\t' ) // a continuation
+            {
+                if( records.empty() ) fail( r, "continuation without a record" );
+                records.back().tok.insert( records.back().tok.end(), r.tok.begin(), r.tok.end() );
+            }
+            else
+                records.push_back( r );
+        }
+        p = *eol ? eol + 1 : eol;
+    }
+    return records;
+}
+
+float number( const Record &r, size_t i )
+{
+    if( i >= r.tok.size() ) fail( r, "missing value for '" + r.tok[0] + "'" );
+    char *end;
+    const float v = strtof( r.tok[i].c_str(), &end );
+    if( *end || end == r.tok[i].c_str() ) fail( r, "'" + r.tok[i] + "' is not a number" );
+    return v;
+}
+
+void arity( const Record &r, size_t min, size_t max )
+{
+    if( r.tok.size() < min || r.tok.size() > max ) fail( r, "wrong number of values for '" + r.tok[0] + "'" );
+}
+
+uint32_t lookup( const Record &r, const map<string, uint32_t> &names, const string &name, const char *kind )
+{
+    auto it = names.find( name );
+    if( it == names.end() ) fail( r, string( "unknown " ) + kind + " '" + name + "'" );
+    return it->second;
+}
+
+}
+
+void Basin::compile( const char *text )
+{
+    release();
+
+    const vector<Record> records = tokenize( text );
+
+    // the steps come first as every series is checked against them
+    uint32_t steps = 0;
+    for( const Record &r : records )
+        if( r.tok[0] == "steps" )
+        {
+            arity( r, 2, 2 );
+            const float v = number( r, 1 );
+            if( !(v >= 1 && v == uint32_t( v )) ) fail( r, "steps must be a positive integer" );
+            steps = uint32_t( v );
+        }
+    if( !steps ) throw new runtime_error( "basin has no steps" );
+
+    BasinHeader h;
+    memset( &h, 0, sizeof(h) );
+    memcpy( h.magic, Magic, sizeof(Magic) );
+    h.version = Version;
+    h.steps = steps;
+    h.demand = NoSeries;
+
+    // the pooled data, by kind and name
+    vector<float> pool;
+    map<string, uint32_t> charts, feasibles, roughs, series, plantIndex;
+    vector<const Record *> plantRecords, unitRecords;
+    bool system = false;
+    for( const Record &r : records )
+    {
+        const string &kind = r.tok[0];
+        if( kind == "steps" ) continue;
+        if( kind == "system" )
+        {
+            arity( r, 3, 3 );
+            h.qIntegration = number( r, 1 );
+            h.pConversion = number( r, 2 );
+            system = true;
+        }
+        else if( kind == "chart" || kind == "feasible" || kind == "rough" || kind == "series" )
+        {
+            if( r.tok.size() < 2 ) fail( r, "missing name for '" + kind + "'" );
+            map<string, uint32_t> &names = kind == "chart" ? charts : kind == "feasible" ? feasibles : kind == "rough" ? roughs : series;
+            if( names.count( r.tok[1] ) ) fail( r, kind + " '" + r.tok[1] + "' is defined twice" );
+            const uint32_t offset = (uint32_t)pool.size();
+            for( size_t i = 2; i < r.tok.size(); i++ ) pool.push_back( number( r, i ) );
+            const uint32_t n = (uint32_t)pool.size();
+            if( kind == "chart" && !(chartFits( pool.data(), n, offset ) && pool.back() < 0) )
+                fail( r, "chart '" + r.tok[1] + "' is malformed" );
+            if( kind == "feasible" && !(n > offset && polygonFits( pool.data(), n, offset + 1 ) && pool.back() < 0) )
+                fail( r, "feasible zone '" + r.tok[1] + "' is malformed" );
+            if( kind == "rough" && !(polygonFits( pool.data(), n, offset ) && pool.back() < 0) )
+                fail( r, "rough zone '" + r.tok[1] + "' is malformed" );
+            if( kind == "series" && n - offset != steps )
+                fail( r, "series '" + r.tok[1] + "' has " + to_string( n - offset ) + " values, not " + to_string( steps ) );
+            names[ r.tok[1] ] = offset;
+        }
+        else if( kind == "plant" )
+        {
+            arity( r, 10, 10 );
+            if( plantIndex.count( r.tok[1] ) ) fail( r, "plant '" + r.tok[1] + "' is defined twice" );
+            plantIndex[ r.tok[1] ] = (uint32_t)plantRecords.size();
+            plantRecords.push_back( &r );
+        }
+        else if( kind == "unit" )
+        {
+            arity( r, 5, 6 );
+            unitRecords.push_back( &r );
+        }
+        else if( kind == "demand" )
+        {
+            arity( r, 2, 2 );
+            if( h.demand != NoSeries ) fail( r, "demand is given twice" );
+            h.demand = 0; // resolved below, once every series is known
+        }
+        else
+            fail( r, "unknown record '" + kind + "'" );
+    }
+    if( !system ) throw new runtime_error( "basin has no system coefs" );
+    if( plantRecords.empty() ) throw new runtime_error( "basin has no plants" );
+    if( h.demand == NoSeries ) throw new runtime_error( "basin has no demand" );
+    for( const Record &r : records )
+        if( r.tok[0] == "demand" ) h.demand = lookup( r, series, r.tok[1], "series" );
+
+    // plants and their units, in file order
+    const uint32_t plantCount = (uint32_t)plantRecords.size();
+    vector<BasinPlant> plants( plantCount );
+    vector<vector<BasinUnit>> plantUnits( plantCount );
+    for( uint32_t p = 0; p < plantCount; p++ )
+    {
+        const Record &r = *plantRecords[p];
+        BasinPlant &plant = plants[p];
+        plant.ssSlope = number( r, 2 );
+        plant.ssMin = number( r, 3 );
+        plant.ssMax = number( r, 4 );
+        plant.twSlope = number( r, 5 );
+        plant.warmupQ = number( r, 6 );
+        plant.spinQ = number( r, 7 );
+        if( !(plant.ssSlope > 0 && plant.ssMax > plant.ssMin) ) fail( r, "plant '" + r.tok[1] + "' has a bad stage-storage curve" );
+        plant.inflow = r.tok[8] == "-" ? NoSeries : lookup( r, series, r.tok[8], "series" );
+        plant.downstream = r.tok[9] == "-" ? -1 : (int32_t)lookup( r, plantIndex, r.tok[9], "plant" );
+        if( plant.downstream == (int32_t)p ) fail( r, "plant '" + r.tok[1] + "' discharges into itself" );
+    }
+    for( const Record *pr : unitRecords )
+    {
+        const Record &r = *pr;
+        BasinUnit unit;
+        const uint32_t p = lookup( r, plantIndex, r.tok[1], "plant" );
+        unit.chart = lookup( r, charts, r.tok[2], "chart" );
+        unit.feasible = lookup( r, feasibles, r.tok[3], "feasible zone" );
+        unit.rough = lookup( r, roughs, r.tok[4], "rough zone" );
+        const float count = r.tok.size() > 5 ? number( r, 5 ) : 1.f;
+        if( !(count >= 1 && count == uint32_t( count )) ) fail( r, "unit count must be a positive integer" );
+        plantUnits[p].insert( plantUnits[p].end(), uint32_t( count ), unit );
+    }
+
+    // order the plants upstream first, preferring file order
+    vector<uint32_t> order, upstream( plantCount, 0 );
+    vector<bool> placed( plantCount, false );
+    for( const BasinPlant &plant : plants )
+        if( plant.downstream >= 0 ) upstream[ plant.downstream ]++;
+    while( order.size() < plantCount )
+    {
+        uint32_t p = 0;
+        while( p < plantCount && (placed[p] || upstream[p]) ) p++;
+        if( p == plantCount )
+        {
+            p = 0;
+            while( placed[p] ) p++;
+            fail( *plantRecords[p], "the cascade has a cycle through plant '" + plantRecords[p]->tok[1] + "'" );
+        }
+        placed[p] = true;
+        order.push_back( p );
+        if( plants[p].downstream >= 0 ) upstream[ plants[p].downstream ]--;
+    }
+    vector<int32_t> position( plantCount );
+    for( uint32_t i = 0; i < plantCount; i++ ) position[ order[i] ] = (int32_t)i;
+
+    // lay out the image
+    vector<BasinPlant> orderedPlants;
+    vector<BasinUnit> units;
+    string names;
+    for( uint32_t p : order )
+    {
+        BasinPlant plant = plants[p];
+        if( plant.downstream >= 0 ) plant.downstream = position[ plant.downstream ];
+        plant.firstUnit = (uint32_t)units.size();
+        plant.unitCount = (uint32_t)plantUnits[p].size();
+        plant.name = (uint32_t)names.size();
+        units.insert( units.end(), plantUnits[p].begin(), plantUnits[p].end() );
+        names += plantRecords[p]->tok[1];
+        names += '\0';
+        orderedPlants.push_back( plant );
+    }
+    if( units.empty() ) throw new runtime_error( "basin has no units" );
+    names.resize( (names.size() + 3) & ~size_t( 3 ), '\0' );
+
+    h.plants = plantCount;
+    h.units = (uint32_t)units.size();
+    h.poolWords = (uint32_t)pool.size();
+    h.namesBytes = (uint32_t)names.size();
+    h.bytes = uint32_t( sizeof(h) + h.plants * sizeof(BasinPlant) + h.units * sizeof(BasinUnit) + h.poolWords * sizeof(float) + h.namesBytes );
+
+    owned.resize( h.bytes / sizeof(uint32_t) );
+    uint8_t *p = (uint8_t *)owned.data();
+    auto put = [&p]( const void *src, size_t n ) { memcpy( p, src, n ); p += n; };
+    put( &h, sizeof(h) );
+    put( orderedPlants.data(), h.plants * sizeof(BasinPlant) );
+    put( units.data(), h.units * sizeof(BasinUnit) );
+    put( pool.data(), h.poolWords * sizeof(float) );
+    put( names.data(), h.namesBytes );
+
+    if( !attach( (const uint8_t *)owned.data(), h.bytes ) )
+        throw new runtime_error( "basin image failed validation" );
+}
+
+bool Basin::attach( const uint8_t *p, size_t bytes )
+{
+    if( bytes < sizeof(BasinHeader) ) return false;
+    const BasinHeader &h = *(const BasinHeader *)p;
+    if( memcmp( h.magic, Magic, sizeof(Magic) ) || h.version != Version || h.bytes != bytes ) return false;
+    const uint64_t expected = sizeof(h) + (uint64_t)h.plants * sizeof(BasinPlant) + (uint64_t)h.units * sizeof(BasinUnit) +
+                              (uint64_t)h.poolWords * sizeof(float) + h.namesBytes;
+    if( expected != bytes || !h.steps || !h.plants || !h.units || !h.namesBytes ) return false;
+
+    image = p;
+    const uint32_t n = h.poolWords;
+    const float *v = pool();
+    const char *names = name( plants()[0] );
+    bool ok = (uint64_t)h.demand + h.steps <= n && names[ h.namesBytes - 1 ] == '\0';
+    for( uint32_t i = 0; ok && i < h.plants; i++ )
+    {
+        const BasinPlant &plant = plants()[i];
+        ok = (plant.inflow == NoSeries || (uint64_t)plant.inflow + h.steps <= n) &&
+             (plant.downstream == -1 || (plant.downstream > (int32_t)i && plant.downstream < (int32_t)h.plants)) &&
+             (uint64_t)plant.firstUnit + plant.unitCount <= h.units && plant.name < h.namesBytes;
+    }
+    for( uint32_t i = 0; ok && i < h.units; i++ )
+    {
+        const BasinUnit &unit = units()[i];
+        ok = chartFits( v, n, unit.chart ) && unit.feasible < n && polygonFits( v, n, unit.feasible + 1 ) &&
+             polygonFits( v, n, unit.rough );
+    }
+    if( !ok ) image = nullptr;
+    return ok;
+}
+
+bool Basin::mapImage( const char *path )
+{
+    int fd = open( path, O_RDONLY );
+    if( fd < 0 ) return false;
+    struct stat st;
+    void *m = MAP_FAILED;
+    if( fstat( fd, &st ) == 0 && (size_t)st.st_size >= sizeof(BasinHeader) )
+        m = mmap( 0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if( m == MAP_FAILED ) return false;
+    if( !attach( (const uint8_t *)m, (size_t)st.st_size ) )
+    {
+        munmap( m, (size_t)st.st_size );
+        return false;
+    }
+    mapped = m;
+    mappedBytes = (size_t)st.st_size;
+    return true;
+}
+
+void Basin::load( const char *path )
+{
+    release();
+    if( mapImage( path ) ) return;
+
+    FILE *fp = fopen( path, "rb" );
+    if( !fp ) throw new runtime_error( string( "can't open basin " ) + path );
+    string text;
+    char buf[4096];
+    for( size_t n; (n = fread( buf, 1, sizeof(buf), fp )) > 0; ) text.append( buf, n );
+    fclose( fp );
+    if( text.compare( 0, sizeof(Magic), Magic, sizeof(Magic) ) == 0 )
+        throw new runtime_error( string( "basin image " ) + path + " is damaged or of another version" );
+
+    const string cache = string( path ) + ".bin";
+    struct stat st, cst;
+    if( stat( path, &st ) == 0 && stat( cache.c_str(), &cst ) == 0 && cst.st_mtime > st.st_mtime && mapImage( cache.c_str() ) )
+        return;
+
+    compile( text.c_str() );
+    save( cache.c_str() );
+}
+
+bool Basin::save( const char *path ) const
+{
+    // written aside and renamed, so other processes loading the same basin never map a partial image
+    const string temp = string( path ) + "." + to_string( getpid() );
+    FILE *fp = fopen( temp.c_str(), "wb" );
+    if( !fp ) return false;
+    bool ok = fwrite( image, 1, header().bytes, fp ) == header().bytes;
+    ok = fclose( fp ) == 0 && ok;
+    ok = ok && rename( temp.c_str(), path ) == 0;
+    if( !ok ) remove( temp.c_str() );
+    return ok;
+}
+
+void Basin::release()
+{
+    if( mapped ) munmap( mapped, mappedBytes );
+    mapped = nullptr;
+    mappedBytes = 0;
+    owned.clear();
+    image = nullptr;
+}
+
+}
@@ -0,0 +1,105 @@
+// copyright 2016 john howard (orthopteroid@gmail.com)
+// MIT license
+
+#ifndef PSYCHICSNIFFLE_HYDRO_BASIN_H
+#define PSYCHICSNIFFLE_HYDRO_BASIN_H
+
+#include <sys/types.h>
+#include <cstdint>
+#include <vector>
+
+namespace hydro {
+
+/**
+ A basin describes any number of plants in a cascade, the units at each plant with the hill chart and
+ zones they run on, and the timeseries that drive them. Basins are written as text and compiled to a
+ flat image of 32-bit words. The image is cached beside the text (as <file>.bin) and memory-mapped on
+ later loads, so a large basin loads without being parsed again until its text changes.
+
+ The text is line oriented. '#' starts a comment and a line starting with whitespace continues the
+ record above it. Values are separated by whitespace or commas.
+
+   steps N                              timesteps in every series
+   system QINTEGRATION PCONVERSION      discharge integration and power conversion coefs
+   chart NAME minp minh maxp maxh h p e p e .. -1 h .. -1 -1    a hill chart, as for CalcInterpolate
+   feasible NAME avgp p h p h .. -1     a feasible zone polygon, as for CalcSpan
+   rough NAME p h p h .. -1             a rough zone polygon, as for CalcContains
+   series NAME v1 .. vN                 a timeseries, such as an inflow or a demand
+   plant NAME ssslope ssmin ssmax twslope warmupq spinq INFLOW|- DOWNSTREAM|-
+   unit PLANT CHART FEASIBLE ROUGH [COUNT]
+   demand SERIES
+
+ A plant's inflow is its own series, if it has one, plus the discharge and spill of every plant that
+ names it as downstream. Names may be used before they are defined. In the image the plants are
+ ordered upstream first, which is the order they're simulated in; a cycle in the cascade is an error.
+ */
+
+struct BasinHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t bytes;             // of the whole image
+    uint32_t steps, plants, units;
+    float qIntegration, pConversion;
+    uint32_t demand;            // pool offset of the demand series
+    uint32_t poolWords, namesBytes;
+};
+
+struct BasinPlant
+{
+    float ssSlope, ssMin, ssMax, twSlope;
+    float warmupQ, spinQ;
+    uint32_t inflow;            // pool offset of the plant's own inflow series, or Basin::NoSeries
+    int32_t downstream;         // index of the plant it discharges into, or -1
+    uint32_t firstUnit, unitCount;
+    uint32_t name;              // offset in the names
+};
+
+struct BasinUnit
+{
+    uint32_t chart, feasible, rough; // pool offsets
+};
+
+// The image is: header, plants, units, the pool of floats the charts, zones and series are
+// stored in, then the nul-terminated plant names.
+class Basin
+{
+public:
+    static const uint32_t NoSeries = UINT32_MAX;
+
+    Basin() : image(nullptr), mapped(nullptr), mappedBytes(0) {}
+    ~Basin() { release(); }
+    Basin(const Basin&) = delete;
+    Basin& operator=(const Basin&) = delete;
+
+    // Loads a basin image, or a text basin through its cached image, compiling and caching it when
+    // the cache is missing, stale or unreadable. The cache is best effort: if it can't be written the
+    // compiled image is used from memory.
+    void load( const char *path );
+
+    // Compiles a text basin to an image held in memory.
+    void compile( const char *text );
+
+    // Writes the image, for load() to map. Returns false on failure.
+    bool save( const char *path ) const;
+
+    const BasinHeader &header() const { return *(const BasinHeader *)image; }
+    const BasinPlant *plants() const { return (const BasinPlant *)( image + sizeof(BasinHeader) ); }
+    const BasinUnit *units() const { return (const BasinUnit *)( plants() + header().plants ); }
+    const float *pool( uint32_t offset = 0 ) const { return (const float *)( units() + header().units ) + offset; }
+    const char *name( const BasinPlant &plant ) const { return (const char *)pool( header().poolWords ) + plant.name; }
+
+private:
+    std::vector<uint32_t> owned;
+    const uint8_t *image;
+    void *mapped;
+    size_t mappedBytes;
+
+    void release();
+    bool attach( const uint8_t *p, size_t bytes ); // validates the image
+    bool mapImage( const char *path );
+};
+
+}
+
+#endif //PSYCHICSNIFFLE_HYDRO_BASIN_H
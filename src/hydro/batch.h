@@ -0,0 +1,257 @@
+// copyright 2016 john howard (orthopteroid@gmail.com)
+// MIT license
+
+#ifndef PSYCHICSNIFFLE_HYDRO_BATCH_H
+#define PSYCHICSNIFFLE_HYDRO_BATCH_H
+
+#include "hydro/hydro.h"
+
+namespace hydro {
+
+/**
+ The batched simulation advances BatchLanes candidates in lockstep, one timestep at a time. Each
+ quantity of a unit or a plant is held in a lane per candidate, structure-of-arrays style. The lane
+ loops don't branch on the unit states: every lane works out the outcome of each state and selects
+ its own, so the loops vectorize and the charts and zones stay hot in cache for the whole batch.
+ Lane for lane, the results are those of UnitStep and PlantStep for the same candidate.
+ */
+
+const uint BatchLanes = 8;
+
+// SpanTable::lookup over the lanes, with selects in place of its branches
+inline void LookupSpanLanes( const SpanTable &table, const float *h, float *min, float *span )
+{
+    const float *pmin = table.pmin.data(), *pspan = table.pspan.data();
+    const int last = int( table.n ) - 2;
+#pragma omp simd
+    for( uint l = 0; l < BatchLanes; l++ )
+    {
+        const bool inside = (h[l] >= table.minH) & (h[l] <= table.maxH);
+        const float yh = (h[l] - table.minH) * table.invDH;
+        const float y = inside ? yh : 0.f;
+        const int j = std::min( int( y ), last );
+        const float f = y - j;
+        const float min0 = pmin[j], min1 = pmin[j + 1], span0 = pspan[j], span1 = pspan[j + 1];
+        const bool lerp = (span0 > 0.f) & (span1 > 0.f), near0 = f < .5f;
+        const float lerpMin = min0 + f * (min1 - min0), lerpSpan = span0 + f * (span1 - span0);
+        min[l] = !inside ? 0.f : lerp ? lerpMin : near0 ? min0 : min1;
+        span[l] = !inside ? 0.f : lerp ? lerpSpan : near0 ? span0 : span1;
+    }
+}
+
+// HillChart::lookup over the lanes, with selects in place of its branches
+inline void LookupHillLanes( const HillChart &chart, const float *p, const float *h, float *e )
+{
+    const float *grid = chart.e.data();
+    const float maxX = float( chart.np - 1 ), maxY = float( chart.nh - 1 );
+    const int lastI = int( chart.np ) - 2, lastJ = int( chart.nh ) - 2, np = int( chart.np );
+#pragma omp simd
+    for( uint l = 0; l < BatchLanes; l++ )
+    {
+        float x = (p[l] - chart.minP) * chart.invDP, y = (h[l] - chart.minH) * chart.invDH;
+        x = x < 0.f ? 0.f : x > maxX ? maxX : x;
+        y = y < 0.f ? 0.f : y > maxY ? maxY : y;
+        const int i = std::min( int( x ), lastI ), j = std::min( int( y ), lastJ );
+        const float fx = x - i, fy = y - j;
+        const int k = j * np + i;
+        const float e00 = grid[k], e01 = grid[k + 1], e10 = grid[k + np], e11 = grid[k + np + 1];
+        e[l] = (1.f - fy) * (e00 + fx * (e01 - e00)) + fy * (e10 + fx * (e11 - e10));
+    }
+}
+
+// a unit's operation for the current timestep, in each lane
+struct UnitOpLanes
+{
+    uint8_t op[BatchLanes];
+    float frac[BatchLanes];
+};
+
+struct UnitLanes
+{
+    int32_t m_CurState[BatchLanes]; // a StateType, widened to the lanes' width
+    float m_AvgQ[BatchLanes], m_AvgP[BatchLanes], m_AvgE[BatchLanes];
+
+    void initialize()
+    {
+        for( uint l = 0; l < BatchLanes; l++ )
+        {
+            m_CurState[l] = (int32_t)StateType::STOP;
+            m_AvgQ[l] = m_AvgP[l] = m_AvgE[l] = 0.f;
+        }
+    }
+
+    // as UnitStep::simulate, for the state each lane is in.
+    // returns true when a generating lane is outside its feasible zone.
+    bool simulate(
+        const UnitOpLanes &op,
+        const float *fHead,
+        const UnitCoefs &coefs,
+        float fWarmupQ, float fSpinQ, float fPConvCoef
+    )
+    {
+        int generating = 0;
+        for( uint l = 0; l < BatchLanes; l++ ) generating |= m_CurState[l] == (int32_t)StateType::GENERATE;
+
+        // P is calculated from the frac of the op. the charts are only read when some lane is generating,
+        // otherwise P and E stay zero for the masked-off Q below
+        float pmin[BatchLanes], pspan[BatchLanes], p[BatchLanes] = {}, e[BatchLanes] = {};
+        int infeasible = 0;
+        if( generating )
+        {
+            LookupSpanLanes( *coefs.m_FeasZone, fHead, pmin, pspan );
+#pragma omp simd reduction(|:infeasible)
+            for( uint l = 0; l < BatchLanes; l++ )
+            {
+                infeasible |= (m_CurState[l] == (int32_t)StateType::GENERATE) & (pmin[l] * pspan[l] < 1.f);
+                p[l] = pmin[l] + pspan[l] * op.frac[l];
+            }
+            LookupHillLanes( *coefs.m_PHE, p, fHead, e );
+        }
+
+#pragma omp simd
+        for( uint l = 0; l < BatchLanes; l++ )
+        {
+            const int32_t state = m_CurState[l];
+            const bool generate = state == (int32_t)StateType::GENERATE;
+
+            // no P or E unless generating. Q is none when stopped, spin Q when spinning and warmup Q otherwise
+            const float idleQ = state == (int32_t)StateType::STOP ? 0.f : state == (int32_t)StateType::SPIN ? fSpinQ : fWarmupQ;
+            const float q = CalcQ( p[l], e[l], fHead[l], fPConvCoef );
+            m_AvgP[l] = generate ? p[l] : 0.f;
+            m_AvgE[l] = generate ? e[l] : 0.f;
+            m_AvgQ[l] = generate ? q : idleQ;
+        }
+        return infeasible != 0;
+    }
+};
+
+struct PlantLanes
+{
+    float m_Vol[BatchLanes];  // reservoir volume
+    float m_Head[BatchLanes]; // net-head
+    float m_AvgP[BatchLanes]; // plant power, only for running units
+    float m_AvgE[BatchLanes]; // plant efficiency, only for running units
+    float m_AvgQ[BatchLanes]; // plant power discharge
+    float m_AvgS[BatchLanes]; // reservoir spill, sometimes required for mass continuity
+    uint8_t m_iAncillary[BatchLanes];
+
+    // the lanes of PlantStep::ContinuityAdjustor
+    struct ContinuityAdjustor
+    {
+        float totQ[BatchLanes], totP[BatchLanes], totE[BatchLanes];
+        uint numE[BatchLanes];
+        float adjV[BatchLanes], newPondElev[BatchLanes];
+    };
+
+    void initialize( const PlantStep &init )
+    {
+        for( uint l = 0; l < BatchLanes; l++ )
+        {
+            m_Vol[l] = init.m_Vol;
+            m_Head[l] = init.m_Head;
+            m_AvgP[l] = init.m_AvgP;
+            m_AvgE[l] = init.m_AvgE;
+            m_AvgQ[l] = init.m_AvgQ;
+            m_AvgS[l] = init.m_AvgS;
+            m_iAncillary[l] = init.m_iAncillary;
+        }
+    }
+
+    // as PlantStep::simulate, where the previous timestep of the plant and its units is the current
+    // state of the lanes, which are advanced in place.
+    // returns true when a generating unit is outside its feasible zone in any lane.
+    bool simulate(
+        UnitLanes *unitArr, const UnitOpLanes *unitOpArr,
+        const float *avgI,
+        const PlantCoefs &coefs
+    )
+    {
+        // apply the unit operation to the unit state, for the current timestep
+        for( size_t u = 0; u < coefs.m_UnitCount; u++ )
+            for( uint l = 0; l < BatchLanes; l++ )
+                unitArr[u].m_CurState[l] = (int32_t)CalcNextState( (StateType)unitArr[u].m_CurState[l], unitOpArr[u].op[l] );
+
+        // iterate on unit operation and average the operating head.
+        ContinuityAdjustor adjustor;
+
+        bool infeasible = false;
+        for( int pass = 0; pass < 2; pass++ )
+        {
+            infeasible |= calc( adjustor, unitArr, unitOpArr, avgI, coefs );
+#pragma omp simd
+            for( uint l = 0; l < BatchLanes; l++ )
+                m_Head[l] = ( m_Head[l] + adjustor.newPondElev[l] - coefs.m_TWslope * ( m_AvgQ[l] + m_AvgS[l] ) ) / 2.f;
+        }
+
+        // update plant stats
+#pragma omp simd
+        for( uint l = 0; l < BatchLanes; l++ )
+        {
+            m_Vol[l] = m_Vol[l] + coefs.m_SysCoefs->m_QIntegrationCoef * ( adjustor.adjV[l] - m_AvgQ[l] - m_AvgS[l] );
+            m_AvgP[l] = adjustor.totP[l];
+            const float avgE = adjustor.totE[l] / std::max( adjustor.numE[l], 1u );
+            m_AvgE[l] = adjustor.numE[l] == 0 ? 0.f : avgE;
+        }
+
+        // units providing hz support
+        for( uint l = 0; l < BatchLanes; l++ ) m_iAncillary[l] = 0;
+        for( size_t u = 0; u < coefs.m_UnitCount; u++ )
+            for( uint l = 0; l < BatchLanes; l++ )
+            {
+                const int32_t state = unitArr[u].m_CurState[l];
+                m_iAncillary[l] += state == (int32_t)StateType::GENERATE || state == (int32_t)StateType::SPIN;
+            }
+        return infeasible;
+    }
+
+private:
+    bool calc( ContinuityAdjustor &adjustor, UnitLanes *unitArr, const UnitOpLanes *unitOpArr, const float *avgI, const PlantCoefs &coefs )
+    {
+        const float tol = .01f; // as StatAvg::incGZ
+        for( uint l = 0; l < BatchLanes; l++ )
+        {
+            adjustor.totQ[l] = adjustor.totP[l] = adjustor.totE[l] = 0.f;
+            adjustor.numE[l] = 0;
+        }
+
+        bool infeasible = false;
+        for( size_t u = 0; u < coefs.m_UnitCount; u++ )
+        {
+            UnitLanes &unit = unitArr[u];
+            infeasible |= unit.simulate(
+                unitOpArr[u],
+                m_Head,
+                coefs.m_UnitArr[u],
+                coefs.m_WarmupQ, coefs.m_SpinQ,
+                coefs.m_SysCoefs->m_PConversionCoef
+            );
+#pragma omp simd
+            for( uint l = 0; l < BatchLanes; l++ )
+            {
+                adjustor.totQ[l] += unit.m_AvgQ[l] > tol ? unit.m_AvgQ[l] : 0.f;
+                adjustor.totP[l] += unit.m_AvgP[l] > tol ? unit.m_AvgP[l] : 0.f;
+                adjustor.totE[l] += unit.m_AvgE[l] > tol ? unit.m_AvgE[l] : 0.f;
+                adjustor.numE[l] += unit.m_AvgE[l] > tol;
+            }
+        }
+
+        // calc pond elev and spill, for sake of continuity permit -ve volumes
+        const float qi = coefs.m_SysCoefs->m_QIntegrationCoef;
+#pragma omp simd
+        for( uint l = 0; l < BatchLanes; l++ )
+        {
+            m_AvgQ[l] = adjustor.totQ[l]; // was avg
+            const float pondElev = coefs.m_SSslope * ( m_Vol[l] + qi * ( avgI[l] - m_AvgQ[l] ) );
+            const bool spill = pondElev > coefs.m_SSmax;
+            const float spillQ = ( pondElev - coefs.m_SSmax ) / ( coefs.m_SSslope * qi );
+            m_AvgS[l] = spill ? spillQ : 0.f;
+            adjustor.adjV[l] = spill ? avgI[l] - m_AvgS[l] : avgI[l];
+            adjustor.newPondElev[l] = spill ? coefs.m_SSmax : pondElev < coefs.m_SSmin ? coefs.m_SSmin : pondElev;
+        }
+        return infeasible;
+    }
+};
+
+}
+
+#endif //PSYCHICSNIFFLE_HYDRO_BATCH_H
@@ -88,9 +88,6 @@ struct UnitOp
     }
 };
 
-template<size_t UnitCount>
-using UnitOpArr = UnitOp[UnitCount];
-
 ////////////////////
 // Simulation code
 
@@ -120,12 +117,12 @@ struct UnitStep
     bool isStarting(StateType prev) const { return prev == StateType::STOP && m_CurState != StateType::STOP; }
     bool isStopping(StateType prev) const { return prev != StateType::STOP && m_CurState == StateType::STOP; }
     bool isAncillary() const { return m_CurState == StateType::GENERATE || m_CurState == StateType::SPIN; }
-    bool isRoughZone(const float *pRoughZone, float fHead) const { return CalcContains( pRoughZone, getP(), fHead ); }
+    bool isRoughZone(const ZoneTable &roughZone, float fHead) const { return roughZone.contains( getP(), fHead ); }
 
     void simulate(
         const UnitOp op,
         float fHead,
-        float *pUnitPHE, float *pFeasZone,
+        const HillChart &hill, const SpanTable &feasZone,
         float fWarmupQ, float fSpinQ, float fPConvCoef
     )
     {
@@ -156,14 +153,14 @@ struct UnitStep
             {
                 // P is calculated from the frac of the op
                 float pmin, pspan;
-                CalcSpan( pmin, pspan, pFeasZone, fHead );
+                feasZone.lookup( fHead, pmin, pspan );
                 if( pmin * pspan < 1.f )
                 {
                     throw new runtime_error("Operation outside of feasible region for unit. Extreme head?");
                 }
                 // an improvement here might be to have getFrac specify segment midpoints
                 m_AvgP = pmin + pspan * op.getFrac();
-                m_AvgE = CalcInterpolate( pUnitPHE, m_AvgP, fHead );
+                m_AvgE = hill.lookup( m_AvgP, fHead );
                 m_AvgQ = CalcQ( m_AvgP, m_AvgE, fHead, fPConvCoef );
                 break;
             }
@@ -171,9 +168,14 @@ struct UnitStep
     }
 };
 
-using FloatPtrArr = float*;
+// the charts and zones a unit runs on, compiled once and shared
+struct UnitCoefs
+{
+    const HillChart *m_PHE;       // power X head X efficiency surface, compiled from a special point array
+    const SpanTable *m_FeasZone;  // feasible region, compiled from a polygon with leading powAvg value
+    const ZoneTable *m_RoughZone; // roughzone region, compiled from a polygon
+};
 
-template<uint UnitCount>
 struct PlantCoefs
 {
     float m_SSslope;        // slope of the stage-storage curve
@@ -184,20 +186,15 @@ struct PlantCoefs
     float m_WarmupQ;        // warmup or shutdown Q
     float m_SpinQ;          // spin Q. likely larger than warmup Q.
 
-    SystemCoefs &m_SysCoefs; // reference to shared system coef struct
+    const SystemCoefs *m_SysCoefs; // shared system coef struct
 
-    const uint GetUnitCount() const { return UnitCount; }
+    const uint GetUnitCount() const { return m_UnitCount; }
 
     // for each unit at this plant...
-    FloatPtrArr m_PHEArr[UnitCount];        // power X head X efficiency surface, stored as a special point array
-    FloatPtrArr m_FeasZoneArr[UnitCount];   // polygon describing the feasible region, with leading powAvg value
-    FloatPtrArr m_RoughZoneArr[UnitCount];  // polygon describing the roughzone region
+    uint m_UnitCount;
+    const UnitCoefs *m_UnitArr;
 };
 
-template<uint UnitCount>
-using UnitStepArr = UnitStep[UnitCount];
-
-template<uint UnitCount>
 struct PlantStep
 {
     // plant state for current timestep
@@ -212,7 +209,7 @@ struct PlantStep
     // the continuty adjustor facilitates an iterative continuity calulation
     struct ContinuityAdjustor
     {
-        const PlantCoefs<UnitCount>& coefs;
+        const PlantCoefs& coefs;
         const float avgI;
 
         PlantStep& plantstep;
@@ -220,25 +217,25 @@ struct PlantStep
         float adjV, newPondElev;
 
         ContinuityAdjustor(
-            PlantStep& _plantstep, const float _avgI, const PlantCoefs<UnitCount>& _coefs
+            PlantStep& _plantstep, const float _avgI, const PlantCoefs& _coefs
         )
             : plantstep(_plantstep), coefs(_coefs),
               avgI(_avgI), adjV(0), newPondElev(0)
         {}
 
-        void calc( UnitStepArr<UnitCount>& unitArr, const UnitOpArr<UnitCount>& unitOpArr )
+        void calc( UnitStep *unitArr, const UnitOp *unitOpArr )
         {
             statQ.clear();
             statP.clear();
             statE.clear();
-            for( size_t u = 0; u < UnitCount; u++ )
+            for( size_t u = 0; u < coefs.m_UnitCount; u++ )
             {
                 unitArr[u].simulate(
                     unitOpArr[u],
                     plantstep.m_Head,
-                    coefs.m_PHEArr[u], coefs.m_FeasZoneArr[u],
+                    *coefs.m_UnitArr[u].m_PHE, *coefs.m_UnitArr[u].m_FeasZone,
                     coefs.m_WarmupQ, coefs.m_SpinQ,
-                    coefs.m_SysCoefs.m_PConversionCoef
+                    coefs.m_SysCoefs->m_PConversionCoef
                 );
                 statQ.incGZ( unitArr[ u ].getQ() );
                 statP.incGZ( unitArr[ u ].getP() );
@@ -249,10 +246,10 @@ struct PlantStep
 
             // calc pond elev and spill, for sake of continuity permit -ve volumes
             adjV = avgI;
-            newPondElev = coefs.m_SSslope * ( plantstep.m_Vol + coefs.m_SysCoefs.m_QIntegrationCoef * ( adjV - plantstep.m_AvgQ ) );
+            newPondElev = coefs.m_SSslope * ( plantstep.m_Vol + coefs.m_SysCoefs->m_QIntegrationCoef * ( adjV - plantstep.m_AvgQ ) );
             if( newPondElev > coefs.m_SSmax )
             {
-                plantstep.m_AvgS = ( newPondElev - coefs.m_SSmax ) / ( coefs.m_SSslope * coefs.m_SysCoefs.m_QIntegrationCoef );
+                plantstep.m_AvgS = ( newPondElev - coefs.m_SSmax ) / ( coefs.m_SSslope * coefs.m_SysCoefs->m_QIntegrationCoef );
                 adjV -= plantstep.m_AvgS;
                 newPondElev = coefs.m_SSmax;
             }
@@ -265,7 +262,7 @@ struct PlantStep
 
     float totQS() const { return m_AvgQ + m_AvgS; }
 
-    void initialize(const PlantCoefs<UnitCount>& coefs)
+    void initialize(const PlantCoefs& coefs)
     {
         // reset to half-full
         m_Head = (coefs.m_SSmin + coefs.m_SSmax) / 2.f;
@@ -275,10 +272,10 @@ struct PlantStep
     // no losses: hydraulic, yard, generator
     // common plant pool, common unit tailwater
     void simulate(
-        UnitStepArr<UnitCount> &unitArr, const UnitOpArr<UnitCount> &unitOpArr,
+        UnitStep *unitArr, const UnitOp *unitOpArr,
         const float avgI,
-        const PlantStep prevPlant, const UnitStepArr<UnitCount> &prevUnitArr,
-        const PlantCoefs<UnitCount> &coefs
+        const PlantStep &prevPlant, const UnitStep *prevUnitArr,
+        const PlantCoefs &coefs
     )
     {
         m_Head = prevPlant.m_Head;
@@ -286,7 +283,7 @@ struct PlantStep
 
         // apply the unit operation to the unit state, for the current timestep
         // unit 'operations' are "deltas" to the current unit state
-        for( size_t u = 0; u < UnitCount; u++ )
+        for( size_t u = 0; u < coefs.m_UnitCount; u++ )
         {
             unitArr[u].m_CurState = CalcNextState(prevUnitArr[u].m_CurState, unitOpArr[u].op);
         }
@@ -301,7 +298,7 @@ struct PlantStep
         m_Head = ( m_Head + adjustor.newPondElev - coefs.m_TWslope * ( m_AvgQ + m_AvgS ) ) / 2.f;
 
         // update plant stats
-        m_Vol = prevPlant.m_Vol + coefs.m_SysCoefs.m_QIntegrationCoef * ( adjustor.adjV - m_AvgQ - m_AvgS );
+        m_Vol = prevPlant.m_Vol + coefs.m_SysCoefs->m_QIntegrationCoef * ( adjustor.adjV - m_AvgQ - m_AvgS );
         m_AvgP = adjustor.statP.tot;
         m_AvgE = adjustor.statE.avg();
 
@@ -309,7 +306,7 @@ struct PlantStep
         // accumulate the number of units providing hz support at the plant level as it
         // could be used in an objective function.
         m_iAncillary = 0;
-        for( size_t u = 0; u < UnitCount; u++ )
+        for( size_t u = 0; u < coefs.m_UnitCount; u++ )
         {
             if( unitArr[u].isAncillary() ) m_iAncillary++;
         }
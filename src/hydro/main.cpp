@@ -3,6 +3,8 @@
 
 #include <iostream>
 #include <cstring>
+#include <map>
+#include <vector>
 
 #include <stdint.h>
 #include <stdlib.h>
@@ -12,8 +14,11 @@
 #include <bits/siginfo.h>
 
 #include "hydro/hydro.h"
+#include "hydro/basin.h"
+#include "hydro/batch.h"
 
 #include "sniffle.h"
+#include "islands.h"
 
 #include "cpuinfo.h"
 
@@ -25,162 +30,198 @@ using namespace std;
 using namespace sniffle;
 using namespace hydro;
 
-// hill curve point samples: head vs power vs efficiency
-// http://encyclopedia2.thefreedictionary.com/Hydroturbine (fig 6)
-float m_pUnitPHE[] =
+// the basin run when none is given: 12 timesteps of a 1 unit plant discharging into a 2 unit plant.
+// see hydro/basin.h for the format.
+const char DemoBasin[] = R"(
+steps 12
+# discharge integration coef: storage in xHOURS, discharge in AVGx for 5 min
+# power conversion coef: 62.4 POUNDSPERCUBICFT * 0.746 KWPERHP / 550 FTPOUNDSPERHP, for cfs from kw
+system 0.0833333358 0.0846370906
+
+# hill curve point samples: head vs power vs efficiency
+# http://encyclopedia2.thefreedictionary.com/Hydroturbine (fig 6)
+# min p,h  max p,h, then h, p, e, p, e, ... , -1, h, p, e, p, e, ... , -1, h, ... , -1, -1
+chart fig6 20,12, 130,28,
+    28, 20,89, 80,93.5, 130,92, -1,
+    26, 35,91, 45,92, 50,93, 60,93.5, 80,93.5, 105,93.5, 115,93, 125,92, -1,
+    24, 25,90, 35,91, 42,92, 55,93, 60,93.5, 70,93.5, 95,93.5, 105,93, 125,92, -1,
+    22, 30,90, 35,91, 42,92, 55,93, 65,93.5, 70,93.5, 90,93, 95,92, 105,91, 120,90, -1,
+    21, 65,93.5, -1,
+    20, 30,90, 38,91, 45,92, 65,93, 80,92, 90,91, 105,90, 110,89, 130,84, -1,
+    18.5, 55,92, -1,
+    18, 28,89, 35,90, 42,91, 65,91, 80,90, 85,89, 90,90, 105,84, -1,
+    17.5, 50,91, -1,
+    16.1, 40,90, -1,
+    16, 25,88, 30,89, 45,90, 65,89, 70,88, 85,84, -1,
+    15, 35,89, -1,
+    14, 35,88, 50,88, 65,84, -1,
+    13.5, 35,88, -1,
+    12, 20,0, 120,0, -1,
+    -1
+
+# avg p, then p,h, p,h, ... p,h, -1 clockwise
+feasible fig6 50, 41,27, 130,27, 125,22.5, 100,18, 40,13.5, 35,14, 25,17, 35,26, -1
+# p,h, p,h, ... p,h, -1 clockwise
+rough fig6 90,15, 60,20, 100,23, -1
+
+series inflow 60 45 30 60 75 60 45 30 60 75 60 45
+series demand 0 90 110 90 80 150 210 180 110 90 80 90 # the first step allows a no-cost warmup
+
+#     name  ssslope ssmin ssmax twslope warmupq spinq inflow downstream
+plant upper .05     12    28    .001    10      20    inflow lower
+plant lower .025    12    28    .002    10      20    -      -
+
+#    plant chart feasible rough count
+unit upper fig6  fig6     fig6
+unit lower fig6  fig6     fig6  2
+
+demand demand
+)";
+
+////////////////
+
+// the basin's configuration, data and initial state, built once from a basin and then shared
+// read-only by every simulation on every thread. it owns the compiled charts and zones its plant
+// coefs point to, so it can't be copied or moved. the basin's series are used in place, so the
+// basin must outlive it.
+struct RiverModel
+{
+    uint steps, plantCount, unitCount;
+
+    SystemCoefs syscoefs;
+    std::vector<HillChart> charts;
+    std::vector<SpanTable> feasZones;
+    std::vector<ZoneTable> roughZones;
+    std::vector<UnitCoefs> units;
+
+    // for each plant, upstream first as they are simulated...
+    std::vector<PlantCoefs> plants;
+    std::vector<uint> firstUnit;
+    std::vector<int> downstream;       // the plant it discharges into, or -1
+    std::vector<const float *> inflow; // its own inflow series, or null
+
+    const float *demand;
+
+    // the basin's "current state", from which every simulation starts
+    std::vector<PlantStep> initPlants;
+    std::vector<UnitStep> initUnits;
+
+    RiverModel( const Basin &basin )
+    {
+        const BasinHeader &h = basin.header();
+        steps = h.steps;
+        plantCount = h.plants;
+        unitCount = h.units;
+        syscoefs = { h.qIntegration, h.pConversion };
+        demand = basin.pool( h.demand );
+
+        // compile each chart and zone once, however many units share it
+        std::map<uint32_t, size_t> chartIndex, feasIndex, roughIndex;
+        for( uint u = 0; u < unitCount; u++ )
         {
-            20,12, 130,28, /* min p,h  max p,h */
-            /* h, p, e, p, e, ... , -1, h, p, e, p, e, ... , -1, h, ... , -1, -1 */
-            28, 20,89, 80,93.5, 130,92, -1,
-            26, 35,91, 45,92, 50,93, 60,93.5, 80,93.5, 105,93.5, 115,93, 125,92, -1,
-            24, 25,90, 35,91, 42,92, 55,93, 60,93.5, 70,93.5, 95,93.5, 105,93, 125,92, -1,
-            22, 30,90, 35,91, 42,92, 55,93, 65,93.5, 70,93.5, 90,93, 95,92, 105,91, 120,90, -1,
-            21, 65,93.5, -1,
-            20, 30,90, 38,91, 45,92, 65,93, 80,92, 90,91, 105,90, 110,89, 130,84, -1,
-            18.5, 55,92, -1,
-            18, 28,89, 35,90, 42,91, 65,91, 80,90, 85,89, 90,90, 105,84, -1,
-            17.5, 50,91, -1,
-            16.1, 40,90, -1,
-            16, 25,88, 30,89, 45,90, 65,89, 70,88, 85,84, -1,
-            15, 35,89, -1,
-            14, 35,88, 50,88, 65,84, -1,
-            13.5, 35,88, -1,
-            12, 20,0, 120,0, -1
-                             -1
-        };
-
-float m_pFeasZone[] =
+            const BasinUnit &bu = basin.units()[u];
+            if( !chartIndex.count( bu.chart ) )
+            {
+                chartIndex[ bu.chart ] = charts.size();
+                charts.emplace_back( basin.pool( bu.chart ) );
+            }
+            if( !feasIndex.count( bu.feasible ) )
+            {
+                feasIndex[ bu.feasible ] = feasZones.size();
+                feasZones.emplace_back( basin.pool( bu.feasible ) );
+            }
+            if( !roughIndex.count( bu.rough ) )
+            {
+                roughIndex[ bu.rough ] = roughZones.size();
+                roughZones.emplace_back( basin.pool( bu.rough ) );
+            }
+        }
+        for( uint u = 0; u < unitCount; u++ )
         {
-            50, /* avg p */
-            /* p,h, p,h, ... p,h, -1 */
-            41,27, 130,27, 125,22.5, 100,18, 40,13.5, 35,14, 25,17, 35,26, -1 // clockwise
-        };
+            const BasinUnit &bu = basin.units()[u];
+            units.push_back( { &charts[ chartIndex[ bu.chart ] ], &feasZones[ feasIndex[ bu.feasible ] ], &roughZones[ roughIndex[ bu.rough ] ] } );
+        }
 
-float m_pRoughZone[] =
+        for( uint p = 0; p < plantCount; p++ )
         {
-            /* p,h, p,h, ... p,h, -1 */
-            90,15, 60,20, 100,23, -1, // clockwise
-        };
-
-float demand[] = { /*0.f,*/ 0.f /* allow no-cost warmup*/, 90.f, 110.f, 90.f, 80.f, 150.f, 210.f, 180.f, 110.f, 90.f, 80.f, 90.f };
-
-const float inQK = 1.5f;
-const float inflow[] = { inQK*40.f, inQK*30.f, inQK*20.f, inQK*40.f, inQK*50.f, inQK*40.f, inQK*30.f, inQK*20.f, inQK*40.f, inQK*50.f, inQK*40.f, inQK*30.f };
+            const BasinPlant &bp = basin.plants()[p];
+            PlantCoefs coefs =
+                {
+                    bp.ssSlope, bp.ssMin, bp.ssMax, bp.twSlope, // m_SSslope, m_SSmin, m_SSmax, m_TWslope
+                    bp.warmupQ, bp.spinQ, // m_WarmupQ, m_SpinQ
+                    &syscoefs, // shared object
+                    bp.unitCount, &units[ bp.firstUnit ],
+                };
+            plants.push_back( coefs );
+            firstUnit.push_back( bp.firstUnit );
+            downstream.push_back( bp.downstream );
+            inflow.push_back( bp.inflow == Basin::NoSeries ? nullptr : basin.pool( bp.inflow ) );
+        }
 
-////////////////
+        // reset plants to half-full and units to stopped
+        initPlants.resize( plantCount, PlantStep() );
+        for( uint p = 0; p < plantCount; p++ ) initPlants[p].initialize( plants[p] );
+        initUnits.resize( unitCount, UnitStep() );
+        for( UnitStep &u : initUnits )
+        {
+            u.m_AvgQ = u.m_AvgP = u.m_AvgE = 0;
+            u.m_CurState = StateType::STOP;
+        }
+    }
 
-// configuration constants for basin are lumped into a single struct
-struct RiverConfig
-{
-    PlantCoefs<1> upperC; // 1 unit
-    PlantCoefs<2> lowerC; // 2 units
-};
+    RiverModel(const RiverModel&) = delete;
+    RiverModel& operator=(const RiverModel&) = delete;
 
-// river unit-operations are the solver's "decision variables"
-// the solver makes guesses about "configurations of river operations over the timescale"
-struct RiverOp
-{
-    UnitOpArr<1> upperU; // 1 unit
-    UnitOpArr<2> lowerU; // 2 units
+    // river unit-operations are the solver's "decision variables": a UnitOp per unit per timestep, [step][unit]
+    size_t stateSize() const { return (size_t)steps * unitCount * sizeof(UnitOp); }
 };
 
-template<size_t StepCount>
-using RiverOpArr = RiverOp[StepCount];
-
 // river simulations are required to determine the value of guessed river-operations
 // the timeseries output for each timestep for the whole basin is lumped together
-struct RiverStep
+struct RiverSteps
 {
-    PlantStep<1> upperP;
-    UnitStepArr<1> upperU;
+    std::vector<PlantStep> plants; // [step][plant]
+    std::vector<UnitStep> units;   // [step][unit]
+    std::vector<float> inflow;     // [plant], for the step being simulated
 
-    PlantStep<2> lowerP;
-    UnitStepArr<2> lowerU;
+    const PlantStep *plant( const RiverModel &m, uint t ) const { return &plants[ t * m.plantCount ]; }
+    const UnitStep *unit( const RiverModel &m, uint t ) const { return &units[ t * m.unitCount ]; }
 };
 
-template<size_t StepCount>
-using RiverStepArr = RiverStep[StepCount];
-
-// a helper method that initializes the basin's "current state"
-void Initialize(RiverStep &s, const RiverConfig& c)
-{
-    auto fnUnit = [](UnitStep& u) -> void
-    {
-        u.m_AvgQ = u.m_AvgP = u.m_AvgE = 0;
-        u.m_CurState = StateType::STOP;
-    };
-
-    // reset upper plant and units
-    s.upperP.initialize( c.upperC ); // sadly, no polymophic lambdas in c++11...
-    fnUnit( s.upperU[0] );
-
-    // reset lower plant and units
-    s.lowerP.initialize( c.lowerC ); // sadly, no polymophic lambdas in c++11...
-    fnUnit( s.lowerU[0] );
-    fnUnit( s.lowerU[1] );
-}
-
 // the simulation & objective function routine for the basin.
 // taking an array used to drive the simulation decisions and an array to output the timeseries results.
 // also outputs the objective function value to be used by the solver to weigh the simulation's value.
-template<uint StepCount>
-float Simulate(RiverStepArr<StepCount> &steps, RiverOpArr<StepCount> &ops)
+float Simulate(const RiverModel &model, RiverSteps &steps, const UnitOp *ops)
 {
-    // system integration and mass-conversion coefficients
-    const float IMPERIAL = 62.4f /* POUNDSPERCUBICFT */ * 0.746f /* KWPERHP */ / 550.f /* FTPOUNDSPERHP */; /* for cfs from kw */
-    const float METRIC   = 1000.0f /* WATERDENSITYINKGPERM3 */ * 9.81f /* ACCELDUETOGRAVITY */ / 1000.f /* WATTSPERKW */; /* for cms from kw */
-    SystemCoefs syscoefs =
-        {
-            1.f / 12.f, // discharge integration coef: storage in xHOURS, discharge in AVGx for 5 min
-            IMPERIAL, // power conversion coef
-        };
-
-    const RiverConfig conf =
-        {
-            {
-                // upper plant config
-                .05f, 12.f, 28.f, .001f, // m_SSslope, m_SSmin, m_SSmax, m_TWslope
-                10.f, 20.f, // m_WarmupQ, m_SpinQ
-                syscoefs, // reference to shared object
-                // upper plant unit
-                { m_pUnitPHE },
-                { m_pFeasZone },
-                { m_pRoughZone },
-            },
-            {
-                // lower plant config
-                .025f, 12.f, 28.f, .002f, // m_SSslope, m_SSmin, m_SSmax, m_TWslope
-                10.f, 20.f, // m_WarmupQ, m_SpinQ
-                syscoefs, // reference to shared object
-                // lower plant units
-                {m_pUnitPHE,m_pUnitPHE},
-                {m_pFeasZone,m_pFeasZone},
-                {m_pRoughZone,m_pRoughZone},
-            },
-        };
-
-    // set initial reservoir storage
-    RiverStep initRS;
-    Initialize( initRS, conf );
+    const uint StepCount = model.steps, PlantCount = model.plantCount, UnitCount = model.unitCount;
+    steps.plants.resize( StepCount * PlantCount );
+    steps.units.resize( StepCount * UnitCount );
+    steps.inflow.resize( PlantCount );
 
     // simulate
     for( uint t=0; t<StepCount; t++ )
     {
-        const RiverStep &prevRS = (t == 0) ? initRS : steps[t-1];
-
-        steps[t].upperP.simulate(
-            steps[t].upperU, ops[t].upperU, // current timestep for unit state (output) according to unit operations (input)
-            inflow[t],                      // inflow to upper plant comes from data array (input)
-            prevRS.upperP, prevRS.upperU,   // previous timestep for upper plant and its units (input)
-            conf.upperC
-        );
-
-        steps[t].lowerP.simulate(
-            steps[t].lowerU, ops[t].lowerU, // current timestep for unit state (output) according to unit operations (input)
-            steps[t].upperP.totQS(),        // inflow to lower plant comes from upper plant (input)
-            prevRS.lowerP, prevRS.lowerU,   // previous timestep for lower plant and its units (input)
-            conf.lowerC
-        );
+        const PlantStep *prevP = (t == 0) ? model.initPlants.data() : steps.plant( model, t-1 );
+        const UnitStep *prevU = (t == 0) ? model.initUnits.data() : steps.unit( model, t-1 );
+        PlantStep *curP = &steps.plants[ t * PlantCount ];
+        UnitStep *curU = &steps.units[ t * UnitCount ];
+        const UnitOp *curOp = &ops[ t * UnitCount ];
+
+        // inflow to a plant comes from its data array and the plants upstream of it, which are simulated first
+        for( uint p = 0; p < PlantCount; p++ )
+            steps.inflow[p] = model.inflow[p] ? model.inflow[p][t] : 0.f;
+
+        for( uint p = 0; p < PlantCount; p++ )
+        {
+            const uint u0 = model.firstUnit[p];
+            curP[p].simulate(
+                curU + u0, curOp + u0,        // current timestep for unit state (output) according to unit operations (input)
+                steps.inflow[p],              // inflow to the plant (input)
+                prevP[p], prevU + u0,         // previous timestep for the plant and its units (input)
+                model.plants[p]
+            );
+            if( model.downstream[p] >= 0 ) steps.inflow[ model.downstream[p] ] += curP[p].totQS();
+        }
     }
 
     // collect stats for objective function
@@ -191,31 +232,25 @@ float Simulate(RiverStepArr<StepCount> &steps, RiverOpArr<StepCount> &ops)
     StatPosNeg statPow;
     for( uint t=0; t<StepCount; t++ )
     {
-        // upper plant stats
-        for( int u = 0; u < conf.upperC.GetUnitCount(); u++ )
+        const PlantStep *curP = steps.plant( model, t );
+        const UnitStep *prevU = (t == 0) ? model.initUnits.data() : steps.unit( model, t-1 );
+        const UnitStep *curU = steps.unit( model, t );
+        float pow = 0;
+        for( uint p = 0; p < PlantCount; p++ )
         {
-            const UnitStep &prev = (t == 0) ? initRS.upperU[u] : steps[t-1].upperU[u];
-            const UnitStep &unit = steps[t].upperU[u];
-            if( unit.isStarting( prev.m_CurState ) ) starts++;
-            if( unit.isStopping( prev.m_CurState ) ) stops++;
-            if( unit.isRoughZone( conf.upperC.m_RoughZoneArr[u], steps[t].upperP.m_Head ) ) roughZone++;
-        }
-        statEff.incGZ( steps[t].upperP.m_AvgE );
-
-        // lower plant stats
-        for( int u = 0; u < conf.lowerC.GetUnitCount(); u++ )
-        {
-            const UnitStep &prev = (t == 0) ? initRS.lowerU[u] : steps[t-1].lowerU[u];
-            const UnitStep &unit = steps[t].lowerU[u];
-            if( unit.isStarting( prev.m_CurState ) ) starts++;
-            if( unit.isStopping( prev.m_CurState ) ) stops++;
-            if( unit.isRoughZone( conf.lowerC.m_RoughZoneArr[u], steps[t].lowerP.m_Head ) ) roughZone++;
+            // plant stats
+            for( uint u = model.firstUnit[p]; u < model.firstUnit[p] + model.plants[p].GetUnitCount(); u++ )
+            {
+                if( curU[u].isStarting( prevU[u].m_CurState ) ) starts++;
+                if( curU[u].isStopping( prevU[u].m_CurState ) ) stops++;
+                if( curU[u].isRoughZone( *model.units[u].m_RoughZone, curP[p].m_Head ) ) roughZone++;
+            }
+            statEff.incGZ( curP[p].m_AvgE );
+            pow += curP[p].m_AvgP;
         }
-        statEff.incGZ( steps[t].lowerP.m_AvgE );
 
         // tally off-demand production
-        float pow = steps[t].upperP.m_AvgP + steps[t].lowerP.m_AvgP;
-        statPow.incGT( pow - demand[t], 1.f ); // ignore differences below 1.
+        statPow.incGT( pow - model.demand[t], 1.f ); // ignore differences below 1.
     }
     float powDev = statPow.pos + statPow.neg;
     float totSS = starts + stops;
@@ -229,15 +264,128 @@ float Simulate(RiverStepArr<StepCount> &steps, RiverOpArr<StepCount> &ops)
     ;
 
     // constraints reduce the objective to a smaller, but nonzero value.
-    if( steps[StepCount-1].upperP.m_Vol < steps[0].upperP.m_Vol ) return .001f * obj;
-    if( steps[StepCount-1].lowerP.m_Vol < steps[0].lowerP.m_Vol ) return .001f * obj;
+    const PlantStep *firstP = steps.plant( model, 0 ), *lastP = steps.plant( model, StepCount-1 );
+    for( uint p = 0; p < PlantCount; p++ )
+        if( lastP[p].m_Vol < firstP[p].m_Vol ) return .001f * obj;
 
     return obj;
 }
 
+// working storage for SimulateBatch, one per thread
+struct RiverBatch
+{
+    std::vector<PlantLanes> plants;
+    std::vector<UnitLanes> units;
+    std::vector<UnitOpLanes> ops;    // [unit], for the step being simulated
+    std::vector<uint8_t> prevState;  // [unit][lane], as of the previous step
+    std::vector<float> inflow;       // [plant][lane], for the step being simulated
+    std::vector<float> firstVol;     // [plant][lane], after the first step
+};
+
+// Simulate for up to BatchLanes candidates at once, advancing them together a timestep at a time.
+// the ops are count candidates of model.stateSize() bytes each and their objective values go to f.
+// lanes past the last candidate repeat it, and are discarded.
+void SimulateBatch(const RiverModel &model, RiverBatch &batch, const UnitOp *ops, int count, float_t *f)
+{
+    const uint StepCount = model.steps, PlantCount = model.plantCount, UnitCount = model.unitCount;
+    const uint L = BatchLanes;
+    batch.plants.resize( PlantCount );
+    batch.units.resize( UnitCount );
+    batch.ops.resize( UnitCount );
+    batch.prevState.resize( UnitCount * L );
+    batch.inflow.resize( PlantCount * L );
+    batch.firstVol.resize( PlantCount * L );
+
+    for( uint p = 0; p < PlantCount; p++ ) batch.plants[p].initialize( model.initPlants[p] );
+    for( uint u = 0; u < UnitCount; u++ ) batch.units[u].initialize();
+
+    // stats for the objective function, per lane
+    uint roughZone[L] = {}, starts[L] = {}, stops[L] = {};
+    StatAvg statEff[L];
+    StatPosNeg statPow[L];
+
+    for( uint t=0; t<StepCount; t++ )
+    {
+        // each lane's unit operations for the step
+        for( uint l = 0; l < L; l++ )
+        {
+            const UnitOp *op = &ops[ (size_t)std::min( (int)l, count - 1 ) * StepCount * UnitCount + t * UnitCount ];
+            for( uint u = 0; u < UnitCount; u++ )
+            {
+                batch.ops[u].op[l] = op[u].op;
+                batch.ops[u].frac[l] = op[u].getFrac();
+                batch.prevState[ u * L + l ] = batch.units[u].m_CurState[l];
+            }
+        }
+
+        // inflow to a plant comes from its data array and the plants upstream of it, which are simulated first
+        for( uint p = 0; p < PlantCount; p++ )
+            for( uint l = 0; l < L; l++ )
+                batch.inflow[ p * L + l ] = model.inflow[p] ? model.inflow[p][t] : 0.f;
+
+        for( uint p = 0; p < PlantCount; p++ )
+        {
+            const uint u0 = model.firstUnit[p];
+            PlantLanes &plant = batch.plants[p];
+            if( plant.simulate( &batch.units[u0], &batch.ops[u0], &batch.inflow[ p * L ], model.plants[p] ) )
+                throw new runtime_error("Operation outside of feasible region for unit. Extreme head?");
+            if( model.downstream[p] >= 0 )
+                for( uint l = 0; l < L; l++ )
+                    batch.inflow[ model.downstream[p] * L + l ] += plant.m_AvgQ[l] + plant.m_AvgS[l];
+        }
+
+        // collect stats for the objective function, in the order Simulate does
+        float pow[L] = {};
+        for( uint p = 0; p < PlantCount; p++ )
+        {
+            const PlantLanes &plant = batch.plants[p];
+            for( uint u = model.firstUnit[p]; u < model.firstUnit[p] + model.plants[p].GetUnitCount(); u++ )
+            {
+                const UnitLanes &unit = batch.units[u];
+                for( uint l = 0; l < L; l++ )
+                {
+                    const StateType prev = (StateType)batch.prevState[ u * L + l ], cur = (StateType)unit.m_CurState[l];
+                    starts[l] += prev == StateType::STOP && cur != StateType::STOP;
+                    stops[l] += prev != StateType::STOP && cur == StateType::STOP;
+                    roughZone[l] += model.units[u].m_RoughZone->contains( unit.m_AvgP[l], plant.m_Head[l] );
+                }
+            }
+            for( uint l = 0; l < L; l++ )
+            {
+                statEff[l].incGZ( plant.m_AvgE[l] );
+                pow[l] += plant.m_AvgP[l];
+                if( t == 0 ) batch.firstVol[ p * L + l ] = plant.m_Vol[l];
+            }
+        }
+
+        // tally off-demand production
+        for( uint l = 0; l < L; l++ )
+            statPow[l].incGT( pow[l] - model.demand[t], 1.f ); // ignore differences below 1.
+    }
+
+    for( int l = 0; l < count; l++ )
+    {
+        float powDev = statPow[l].pos + statPow[l].neg;
+        float totSS = starts[l] + stops[l];
+
+        // objective function, as in Simulate
+        float obj =
+            - 4.f * powDev // minimize deviation from demand
+            + 1.f * statEff[l].avg() // maximize efficiency
+            - 2.f * totSS // minimize total starts and stops
+            - 0.f * roughZone[l] // minimize roughzone operation
+        ;
+
+        // constraints reduce the objective to a smaller, but nonzero value.
+        for( uint p = 0; p < PlantCount; p++ )
+            if( batch.plants[p].m_Vol[l] < batch.firstVol[ p * L + l ] ) { obj *= .001f; break; }
+
+        f[l] = obj;
+    }
+}
+
 ///////////////////////
 
-const uint Steps = 12;
 const uint Population = 500;
 
 int lastSignal = 0;
@@ -247,59 +395,132 @@ void sig_handler(int sig, siginfo_t * info, void *context)
     //info->_sifields._timer.si_sigval
 }
 
-int main()
+const uint CheckpointInterval = 100;
+
+// usage: hydro [-b basin-file] [seed|- [checkpoint-file|- [transport ...]]]
+// the basin (see hydro/basin.h) defaults to a demo basin. a text basin is compiled to <basin-file>.bin,
+// which later runs map instead. a seed makes the run repeatable. with a checkpoint file the run resumes from it, when present,
+// and is saved to it periodically and on exit.
+// with transports (see transport.h) the run is an island, exchanging migrants with other hydro
+// processes. for instance, on one host:
+//   hydro 1 - listen:tcp:5555 &
+//   hydro 2 - tcp:127.0.0.1:5555
+int main(int argc, char *argv[])
 {
     srand(int(time(NULL)));
 
+    const char *basinFile = nullptr;
+    if( argc > 2 && strcmp( argv[1], "-b" ) == 0 )
+    {
+        basinFile = argv[2];
+        argv += 2;
+        argc -= 2;
+    }
+    const char *seed = argc > 1 && strcmp( argv[1], "-" ) != 0 ? argv[1] : nullptr;
+    const char *checkpoint = argc > 2 && strcmp( argv[2], "-" ) != 0 ? argv[2] : nullptr;
+
     int cores = 0;
 #if defined(NDEBUG)
     cores = EnumCores();
     omp_set_num_threads(cores);
 #endif
 
+    Basin basin;
+    if( basinFile )
+        basin.load( basinFile );
+    else
+        basin.compile( DemoBasin );
+    const RiverModel model( basin );
+#if defined(DEBUG)
+    {
+        // the first unit's chart and zones are the first compiled
+        const BasinUnit &bu = basin.units()[0];
+        float meanErr, maxErr;
+        model.charts[0].validate( basin.pool( bu.chart ), meanErr, maxErr, basin.pool( bu.feasible + 1 ) );
+        printf("hill chart grid vs CalcInterpolate in the feasible zone: mean error %.4f, max %.4f\n", meanErr, maxErr);
+        model.feasZones[0].validate( basin.pool( bu.feasible ), meanErr, maxErr );
+        printf("feasible zone table vs CalcSpan: mean error %.4f, max %.4f\n", meanErr, maxErr);
+        printf("rough zone table vs CalcContains: %u mismatches in 65536\n", model.roughZones[0].validate( basin.pool( bu.rough ) ));
+    }
+#endif
+
     struct sigaction sigact;
     sigemptyset(&sigact.sa_mask);
     sigact.sa_flags = 0;
     sigact.sa_sigaction = sig_handler;
     sigaction(SIGINT, &sigact, nullptr);
 
-    // the solver's decision variables are "unit operations" for both reservoirs over the timescale
-    Maximizer<RiverOpArr<Steps>, Population, ByteAnalyser> solver;
+    // the solver's decision variables are "unit operations" for all the reservoirs over the timescale.
+    // each unit operation byte packs an op and a frac, which are tracked as separate fields.
+    // ops are labels, so they're categorical.
+    const uint UnitOps = model.steps * model.unitCount;
+    FieldAnalyser schema;
+    schema.add({0, UnitOp::OPBITS, true}, UnitOps, 8 * sizeof(UnitOp));
+    schema.add({UnitOp::OPBITS, UnitOp::FRACBITS, false}, UnitOps, 8 * sizeof(UnitOp));
 
-    // we perform simulations for all the solver's selected unit operations.
-    // this is working storage for those simulations.
-    RiverStepArr<Steps> steps;
+    DynamicMaximizer<FieldAnalyser> solver(Population, model.stateSize(), schema);
+    if( seed ) solver.seed( strtoull( seed, nullptr, 0 ) );
 
-    // each simulation results in an objective value that is then fed back to the solver to tune it's guesses
-    float_t f[Population];
+    Migration migration;
+    for( int a = 3; a < argc; a++ )
+        migration.attach( openTransport( argv[a], model.stateSize() ), true, true );
+
+    // we perform simulations for all the solver's selected unit operations, a batch of them at a time
+    // per thread. the simulation routine is adapted to the solver's fitness function signature.
+    auto fnSimulate = [&model]( const uint8_t *ops, int count, float_t *f, RiverBatch &scratch ) -> void
+    {
+        SimulateBatch( model, scratch, (const UnitOp *)ops, count, f );
+    };
+
+    // working storage for the simulation of the best guess, for output
+    RiverSteps steps;
 
     float_t best = -HUGE_VALF; // solver is a maximizer so initialize to -huge_val
     uint iter = 0;
     solver.reset();
+
+    FILE *fpResume = checkpoint ? fopen( checkpoint, "rb" ) : nullptr;
+    if( fpResume )
+    {
+        solver.restore( fpResume );
+        fclose( fpResume );
+        iter = (uint)solver.generation;
+    }
+
     while( true )
     {
         // Simulate the river system using the solver's guesses at what good operations might look like.
-        // The solver's convention is that the first guess ( f[0] ) is the "current best guess", so
-        // we simulate the guesses is decreasing order so that the last one simulated is the best - which
-        // we shall then print.
-        for( int p=Population-1; p>=0; p-- ) // note: backwards loop
-            f[p] = Simulate<Steps>( steps, solver.GetStateArr()[p] );
+        // Each simulation results in an objective value that is then fed back to the solver to tune it's guesses.
+        float_t *f = solver.evaluateBatch<RiverBatch, BatchLanes>( fnSimulate );
 
         bool terminate = (iter == 10000 || lastSignal == SIGINT );
         if( terminate || f[0] > best || lastSignal ==  SIGUSR1 )
         {
             best = f[0];
 
+            // The solver's convention is that the first guess ( f[0] ) is the "current best guess",
+            // so we simulate it again to have its timeseries to print.
+            const float obj = Simulate( model, steps, (const UnitOp *)solver.GetStateArr() );
+#if defined(DEBUG)
+            if( obj != f[0] ) printf("batched and single simulations disagree: %g vs %g\n", f[0], obj);
+#else
+            (void)obj;
+#endif
+
             // calc summary stats
             StatAvg statPow, statEff;
             StatMinMax statMMPow;
-            for( uint t=0; t<Steps; t++ )
+            for( uint t=0; t<model.steps; t++ )
             {
-                float stepPow = steps[t].upperP.m_AvgP + steps[t].lowerP.m_AvgP;
+                const PlantStep *plantArr = steps.plant( model, t );
+                float stepPow = 0;
+                for( uint p = 0; p < model.plantCount; p++ )
+                {
+                    stepPow += plantArr[p].m_AvgP;
+                    statEff.incGZ( plantArr[p].m_AvgE );
+                }
                 statPow.inc( stepPow );
-                statMMPow.inc( stepPow - demand[t] );
-                statEff.incGZ( steps[t].upperP.m_AvgE );
-                statEff.incGZ( steps[t].lowerP.m_AvgE );
+                statMMPow.inc( stepPow - model.demand[t] );
             }
 
 #if defined(ENABLE_PAGINATED_OUTPUT)
@@ -310,43 +531,54 @@ int main()
             const char cUnitState[] = {'_','d','g','s','G','S'};
 
             printf("%5s %5s %6s %2s ", "Qi", "D", "dP", "A" );
-            printf("! %6s %5s %5s %5s %5s ", "V", "H", "P", "Q", "S" );
-            printf("( %1s %5s %5s ) ", "?", "E", "P" );
-            printf("! %6s %5s %5s %5s %5s ", "V", "H", "P", "Q", "S" );
-            printf("( %1s %5s %5s %1s %5s %5s ) ", "?", "E", "P", "?", "E", "P" );
+            for( uint p = 0; p < model.plantCount; p++ )
+            {
+                printf("! %6s %5s %5s %5s %5s ( ", "V", "H", "P", "Q", "S" );
+                for( uint u = 0; u < model.plants[p].GetUnitCount(); u++ ) printf("%1s %5s %5s ", "?", "E", "P" );
+                printf(") ");
+            }
             putchar('\n');
-            for( uint t=0; t<Steps; t++ )
+            for( uint t=0; t<model.steps; t++ )
             {
-                printf("%5.1f %5.1f %6.1f %2d ",
-                       inflow[t], demand[t], (steps[t].upperP.m_AvgP + steps[t].lowerP.m_AvgP) - demand[t],
-                       steps[t].upperP.m_iAncillary + steps[t].lowerP.m_iAncillary
-                );
-                printf("! %6.1f %5.1f %5.1f %5.1f %5.1f ",
-                       steps[t].upperP.m_Vol, steps[t].upperP.m_Head,
-                       steps[t].upperP.m_AvgP, steps[t].upperP.m_AvgQ, steps[t].upperP.m_AvgS
-                );
-                printf("( %c %5.1f %5.1f ) ",
-                       cUnitState[ steps[t].upperU[0].getState() ], steps[t].upperU[0].m_AvgE, steps[t].upperU[0].m_AvgP
-                );
-                printf("! %6.1f %5.1f %5.1f %5.1f %5.1f ",
-                       steps[t].lowerP.m_Vol, steps[t].lowerP.m_Head,
-                       steps[t].lowerP.m_AvgP, steps[t].lowerP.m_AvgQ, steps[t].lowerP.m_AvgS
-                );
-                printf("( %c %5.1f %5.1f %c %5.1f %5.1f ) ",
-                       cUnitState[ steps[t].lowerU[0].getState() ], steps[t].lowerU[0].m_AvgE, steps[t].lowerU[0].m_AvgP,
-                       cUnitState[ steps[t].lowerU[1].getState() ], steps[t].lowerU[1].m_AvgE, steps[t].lowerU[1].m_AvgP
-                );
+                const PlantStep *plantArr = steps.plant( model, t );
+                const UnitStep *unitArr = steps.unit( model, t );
+                float inflow = 0, stepPow = 0;
+                uint ancillary = 0;
+                for( uint p = 0; p < model.plantCount; p++ )
+                {
+                    if( model.inflow[p] ) inflow += model.inflow[p][t];
+                    stepPow += plantArr[p].m_AvgP;
+                    ancillary += plantArr[p].m_iAncillary;
+                }
+                printf("%5.1f %5.1f %6.1f %2d ", inflow, model.demand[t], stepPow - model.demand[t], ancillary );
+                for( uint p = 0; p < model.plantCount; p++ )
+                {
+                    printf("! %6.1f %5.1f %5.1f %5.1f %5.1f ( ",
+                           plantArr[p].m_Vol, plantArr[p].m_Head,
+                           plantArr[p].m_AvgP, plantArr[p].m_AvgQ, plantArr[p].m_AvgS
+                    );
+                    for( uint u = model.firstUnit[p]; u < model.firstUnit[p] + model.plants[p].GetUnitCount(); u++ )
+                        printf("%c %5.1f %5.1f ", cUnitState[ unitArr[u].getState() ], unitArr[u].m_AvgE, unitArr[u].m_AvgP );
+                    printf(") ");
+                }
                 putchar('\n');
             }
             printf("I %5d E %5.1f P %5.1f MMP %5.1f \n", iter, statEff.avg(), statPow.avg(), statMMPow.maximum() );
             fflush(stdout);
 
-            if( terminate ) break;
+            if( terminate )
+            {
+                if( checkpoint ) solver.save( checkpoint );
+                break;
+            }
         }
 
-        solver.crank(f);
+        migration.exchange( solver, iter );
+        solver.crank();
         iter++;
 
+        if( checkpoint && iter % CheckpointInterval == 0 ) solver.save( checkpoint );
+
     }
     solver.reset();
 
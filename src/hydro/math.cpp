@@ -3,6 +3,8 @@
 
 #include <cmath>
 
+#include "hydro/math.h"
+
 namespace hydro {
 
 using namespace std;
@@ -57,6 +59,39 @@ float CalcInterpolate( const float *chart, float Qp, float Qh)
     return N / D;
 }
 
+void HillChart::compile( const float *chart, uint np_, uint nh_ )
+{
+    // the chart leads with its min p,h and max p,h
+    np = std::max( np_, 2u );
+    nh = std::max( nh_, 2u );
+    minP = chart[0];
+    minH = chart[1];
+    invDP = (np - 1) / (chart[2] - minP);
+    invDH = (nh - 1) / (chart[3] - minH);
+    e.resize( np * nh );
+    for( uint j = 0; j < nh; j++ )
+        for( uint i = 0; i < np; i++ )
+            e[ j * np + i ] = CalcInterpolate( chart, minP + i / invDP, minH + j / invDH );
+}
+
+void HillChart::validate( const float *chart, float &meanErr, float &maxErr, const float *poly ) const
+{
+    double sum = 0;
+    uint n = 0;
+    maxErr = 0;
+    for( uint j = 0; j + 1 < nh; j++ )
+        for( uint i = 0; i + 1 < np; i++ )
+        {
+            const float p = minP + (i + .5f) / invDP, h = minH + (j + .5f) / invDH;
+            if( poly && !CalcContains( poly, p, h ) ) continue;
+            const float err = fabs( lookup( p, h ) - CalcInterpolate( chart, p, h ) );
+            sum += err;
+            maxErr = std::max( maxErr, err );
+            n++;
+        }
+    meanErr = n ? float( sum / n ) : 0.f;
+}
+
 // http://geomalgorithms.com/a03-_inclusion.html
 bool CalcContains( const float* poly, float Qp, float Qh )
 {
@@ -66,12 +101,14 @@ bool CalcContains( const float* poly, float Qp, float Qh )
     while( true )
     {
         float x0 = *(pf+0), y0 = *(pf+1);
-        float x1 = *(pf+2), y1 = *(pf+3);
+        float x1 = *(pf+2), y1;
         float marker = x1;
         if( marker < 0 )
         {
-            x1 = *(poly+0); y1 = *(poly+1); // wrap
+            x1 = *(poly+0); y1 = *(poly+1); // wrap, the marker has no y
         }
+        else
+            y1 = *(pf+3);
 
         auto isLeft = [&] () -> float
         {
@@ -94,21 +131,23 @@ bool CalcContains( const float* poly, float Qp, float Qh )
     return (wn != 0);
 }
 
-void CalcSpan( float& min, float& span, float* poly, float head )
+void CalcSpan( float& min, float& span, const float* poly, float head )
 {
     int wn = 0;    // the winding number counter
     float spanL = HUGE_VALF, spanR = HUGE_VALF;
     const float avgP = poly[0];
-    float* pf = &(poly[1]);
+    const float* pf = &(poly[1]);
     while( true )
     {
         float x0 = *(pf+0), y0 = *(pf+1);
-        float x1 = *(pf+2), y1 = *(pf+3);
+        float x1 = *(pf+2), y1;
         float marker = x1;
         if( marker < 0 )
         {
-            x1 = *(poly+0); y1 = *(poly+1); // wrap
+            x1 = *(poly+1); y1 = *(poly+2); // wrap to the first vertex, after the avg p. the marker has no y
         }
+        else
+            y1 = *(pf+3);
 
         // what side of the vector (x0,y0)-(x1,y1) is the origin of a positive ray (Qp,Qh)-(+inf,Qh)?
         // +ve means left side of vector, -ve means right side of vector (from vector's reference point)
@@ -166,4 +205,155 @@ void CalcSpan( float& min, float& span, float* poly, float head )
     span = spanL + spanR;
 }
 
+//////////////////
+
+void Polygon::compile( const float *poly )
+{
+    edges.clear();
+    minH = HUGE_VALF;
+    maxH = -HUGE_VALF;
+    const float *first = poly;
+    for( const float *pf = poly; *pf >= 0; pf += 2 )
+    {
+        const float *next = pf[2] < 0 ? first : pf + 2;
+        Edge edge;
+        edge.p0 = pf[0];
+        edge.h0 = pf[1];
+        edge.h1 = next[1];
+        edge.slope = next[1] == pf[1] ? 0.f : (next[0] - pf[0]) / (next[1] - pf[1]);
+        edges.push_back( edge );
+        minH = std::min( minH, pf[1] );
+        maxH = std::max( maxH, pf[1] );
+    }
+}
+
+uint Polygon::crossings( float h, float *p, uint max ) const
+{
+    uint n = 0;
+    for( const Edge &edge : edges )
+    {
+        if( (edge.h0 <= h) == (edge.h1 <= h) ) continue; // horizontal edges never cross
+        const float x = edge.at( h );
+        if( n < max )
+        {
+            uint i = n;
+            for( ; i > 0 && p[i - 1] > x; i-- ) p[i] = p[i - 1];
+            p[i] = x;
+        }
+        n++;
+    }
+    return n;
+}
+
+bool Polygon::contains( float p, float h ) const
+{
+    bool inside = false;
+    for( const Edge &edge : edges )
+        if( (edge.h0 <= h) != (edge.h1 <= h) && p < edge.at( h ) )
+            inside = !inside;
+    return inside;
+}
+
+bool Polygon::interval( float p, float h, float &lo, float &hi ) const
+{
+    lo = -HUGE_VALF;
+    hi = HUGE_VALF;
+    bool inside = false;
+    for( const Edge &edge : edges )
+    {
+        if( (edge.h0 <= h) == (edge.h1 <= h) ) continue;
+        const float x = edge.at( h );
+        if( p < x )
+        {
+            inside = !inside;
+            hi = std::min( hi, x );
+        }
+        else
+            lo = std::max( lo, x );
+    }
+    return inside;
+}
+
+void SpanTable::compile( const float *feasZone, uint n_ )
+{
+    // the span is from the crossings either side of the zone's avg p, as CalcSpan finds them
+    Polygon poly( feasZone + 1 );
+    const float avgP = feasZone[0];
+    n = std::max( n_, 2u );
+    minH = poly.minH;
+    maxH = poly.maxH;
+    invDH = (n - 1) / (maxH - minH);
+    pmin.resize( n );
+    pspan.resize( n );
+    for( uint j = 0; j < n; j++ )
+    {
+        float lo, hi;
+        const bool inside = poly.interval( avgP, minH + j / invDH, lo, hi );
+        pmin[j] = inside ? lo : 0.f;
+        pspan[j] = inside ? hi - lo : 0.f;
+    }
+}
+
+void SpanTable::validate( const float *feasZone, float &meanErr, float &maxErr ) const
+{
+    double sum = 0;
+    uint cells = 0;
+    maxErr = 0;
+    for( uint j = 0; j + 1 < n; j++ )
+    {
+        if( !(pspan[j] > 0.f && pspan[j + 1] > 0.f) ) continue;
+        const float h = minH + (j + .5f) / invDH;
+        float tmin, tspan, cmin, cspan;
+        lookup( h, tmin, tspan );
+        CalcSpan( cmin, cspan, feasZone, h );
+        const float err = std::max( fabs( tmin - cmin ), fabs( tspan - cspan ) );
+        sum += err;
+        maxErr = std::max( maxErr, err );
+        cells++;
+    }
+    meanErr = cells ? float( sum / cells ) : 0.f;
+}
+
+void ZoneTable::compile( const float *poly_, uint n_ )
+{
+    Polygon poly( poly_ );
+    n = std::max( n_, 2u );
+    minH = poly.minH;
+    maxH = poly.maxH;
+    invDH = (n - 1) / (maxH - minH);
+    count.resize( n );
+    lo.resize( n * MaxIntervals );
+    hi.resize( n * MaxIntervals );
+    for( uint j = 0; j < n; j++ )
+    {
+        float p[2 * MaxIntervals];
+        const uint c = std::min( poly.crossings( minH + j / invDH, p, 2 * MaxIntervals ), 2 * MaxIntervals );
+        count[j] = (uint8_t) (c / 2);
+        for( uint k = 0; k < count[j]; k++ )
+        {
+            lo[ j * MaxIntervals + k ] = p[ 2 * k ];
+            hi[ j * MaxIntervals + k ] = p[ 2 * k + 1 ];
+        }
+    }
+}
+
+uint ZoneTable::validate( const float *poly, uint samples ) const
+{
+    uint mismatches = 0;
+    float pmin = HUGE_VALF, pmax = -HUGE_VALF;
+    for( const float *pf = poly; *pf >= 0; pf += 2 )
+    {
+        pmin = std::min( pmin, pf[0] );
+        pmax = std::max( pmax, pf[0] );
+    }
+    for( uint j = 0; j < samples; j++ )
+        for( uint i = 0; i < samples; i++ )
+        {
+            const float p = pmin + (pmax - pmin) * (i + .5f) / samples;
+            const float h = minH + (maxH - minH) * (j + .5f) / samples;
+            if( contains( p, h ) != CalcContains( poly, p, h ) ) mismatches++;
+        }
+    return mismatches;
+}
+
 }
@@ -5,7 +5,10 @@
 #define PSYCHICSNIFFLE_HYDRO_MATH_H
 
 #include <sys/types.h>
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <vector>
 
 namespace hydro {
 
@@ -68,6 +71,38 @@ inline float CalcE(float p, float q, float h, float units)
 // uses inverse distce weighting
 float CalcInterpolate( const float *chart, float Qp, float Qh );
 
+// A hill chart compiled to a regular power x head grid of CalcInterpolate's efficiencies, for
+// bilinear lookups in O(1) instead of a nearest-neighbour scan of the whole chart per call.
+// Lookups outside the chart's power and head range are clamped to its edges.
+struct HillChart
+{
+    float minP, minH;
+    float invDP, invDH; // grid nodes per unit of power and head
+    uint np, nh;
+    std::vector<float> e; // [nh][np]
+
+    HillChart() : minP(0), minH(0), invDP(0), invDH(0), np(0), nh(0) {}
+    HillChart( const float *chart, uint np_ = 256, uint nh_ = 128 ) { compile( chart, np_, nh_ ); }
+
+    void compile( const float *chart, uint np_ = 256, uint nh_ = 128 );
+
+    float lookup( float p, float h ) const
+    {
+        float x = (p - minP) * invDP, y = (h - minH) * invDH;
+        Clamp( x, 0.f, float( np - 1 ) );
+        Clamp( y, 0.f, float( nh - 1 ) );
+        const uint i = std::min( uint( x ), np - 2 ), j = std::min( uint( y ), nh - 2 );
+        const float fx = x - i, fy = y - j;
+        const float *e0 = &e[ j * np + i ], *e1 = e0 + np;
+        return (1.f - fy) * (e0[0] + fx * (e0[1] - e0[0])) + fy * (e1[0] + fx * (e1[1] - e1[0]));
+    }
+
+    // Mean and max absolute difference from CalcInterpolate at the centre of every grid cell, which
+    // is where bilinear interpolation is weakest. With a polygon only cells centred in it are counted,
+    // as the nearest-neighbour interpolation jumps wherever its neighbour set changes.
+    void validate( const float *chart, float &meanErr, float &maxErr, const float *poly = 0 ) const;
+};
+
 // http://geomalgorithms.com/a03-_inclusion.html
 bool CalcContains( const float* poly, float Qp, float Qh );
 
@@ -75,7 +110,119 @@ bool CalcContains( const float* poly, float Qp, float Qh );
 // the purpose of this alg is to provide an x-span that can be discreteized by the number of FRACBITS in a UnitOp.
 // (the x value is not necessary to pass in as an arg as it is encoded as the first value of the poly)
 // it may be possible to improve the alg to avoid the use of an x value at all.
-void CalcSpan( float& min, float& span, float* poly, float head );
+void CalcSpan( float& min, float& span, const float* poly, float head );
+
+// A polygon of -1 terminated p,h pairs compiled once to its edges, each holding its slope in
+// power per unit of head so the crossing at any head is one multiply-add.
+struct Polygon
+{
+    struct Edge
+    {
+        float p0, h0, h1, slope;
+        inline float at( float h ) const { return p0 + (h - h0) * slope; }
+    };
+    std::vector<Edge> edges;
+    float minH, maxH;
+
+    Polygon() : minH(0), maxH(0) {}
+    Polygon( const float *poly ) { compile( poly ); }
+
+    void compile( const float *poly );
+
+    // the powers at which the edges cross the given head, sorted ascending. at most max are stored
+    // but all are counted.
+    uint crossings( float h, float *p, uint max ) const;
+
+    // even-odd rule, which agrees with CalcContains' winding number for simple polygons
+    bool contains( float p, float h ) const;
+
+    // the crossings either side of p at the given head, when p is inside (by the rule above)
+    bool interval( float p, float h, float &lo, float &hi ) const;
+};
+
+// A feasible zone (a polygon led by its avg p, as for CalcSpan) compiled to CalcSpan's min and span
+// at evenly spaced heads, from the crossings of its Polygon, and interpolated linearly between them.
+// Next to a node outside the zone the nearest node is used, so the zone's edges stay sharp. Heads
+// outside the zone give a zero span.
+struct SpanTable
+{
+    float minH, maxH;
+    float invDH; // table nodes per unit of head
+    uint n;
+    std::vector<float> pmin, pspan;
+
+    SpanTable() : minH(0), maxH(0), invDH(0), n(0) {}
+    SpanTable( const float *feasZone, uint n_ = 1024 ) { compile( feasZone, n_ ); }
+
+    void compile( const float *feasZone, uint n_ = 1024 );
+
+    inline void lookup( float h, float &min, float &span ) const
+    {
+        if( !(h >= minH && h <= maxH) ) { min = span = 0; return; }
+        const float y = (h - minH) * invDH;
+        const uint j = std::min( uint( y ), n - 2 );
+        const float f = y - j;
+        if( pspan[j] > 0.f && pspan[j + 1] > 0.f )
+        {
+            min = pmin[j] + f * (pmin[j + 1] - pmin[j]);
+            span = pspan[j] + f * (pspan[j + 1] - pspan[j]);
+        }
+        else
+        {
+            const uint k = f < .5f ? j : j + 1;
+            min = pmin[k];
+            span = pspan[k];
+        }
+    }
+
+    // Mean and max absolute difference in min or span from CalcSpan midway between every pair of nodes
+    // inside the zone. Where the zone starts or ends between two nodes the table is off by up to a node.
+    void validate( const float *feasZone, float &meanErr, float &maxErr ) const;
+};
+
+// A zone polygon compiled to the power intervals inside it at evenly spaced heads. When neighbouring
+// nodes have as many intervals their ends are interpolated, otherwise the nearest node is used.
+struct ZoneTable
+{
+    static const uint MaxIntervals = 4;
+
+    float minH, maxH;
+    float invDH; // table nodes per unit of head
+    uint n;
+    std::vector<uint8_t> count;  // [n]
+    std::vector<float> lo, hi;   // [n][MaxIntervals]
+
+    ZoneTable() : minH(0), maxH(0), invDH(0), n(0) {}
+    ZoneTable( const float *poly, uint n_ = 1024 ) { compile( poly, n_ ); }
+
+    void compile( const float *poly, uint n_ = 1024 );
+
+    inline bool contains( float p, float h ) const
+    {
+        if( !(h >= minH && h <= maxH) ) return false;
+        const float y = (h - minH) * invDH;
+        const uint j = std::min( uint( y ), n - 2 );
+        const float f = y - j;
+        if( count[j] == count[j + 1] )
+        {
+            const float *lo0 = &lo[ j * MaxIntervals ], *hi0 = &hi[ j * MaxIntervals ];
+            for( uint k = 0; k < count[j]; k++ )
+            {
+                const float l = lo0[k] + f * (lo0[k + MaxIntervals] - lo0[k]);
+                const float r = hi0[k] + f * (hi0[k + MaxIntervals] - hi0[k]);
+                if( p >= l && p < r ) return true;
+            }
+            return false;
+        }
+        const uint m = f < .5f ? j : j + 1;
+        for( uint k = 0; k < count[m]; k++ )
+            if( p >= lo[ m * MaxIntervals + k ] && p < hi[ m * MaxIntervals + k ] ) return true;
+        return false;
+    }
+
+    // The number of disagreements with CalcContains over a samples x samples grid covering the polygon.
+    uint validate( const float *poly, uint samples = 256 ) const;
+};
 
 }
 
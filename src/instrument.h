@@ -0,0 +1,185 @@
+// copyright 2016 john howard (orthopteroid@gmail.com)
+// MIT license
+//
+// Optional per-generation instrumentation, compiled in with -DSNIFFLE_INSTRUMENT.
+// Without it the hook macros expand to nothing and the solver carries no instrument.
+//
+// Phases are timed by wall clock with split marks: a mark is taken and each split charges the time
+// since the mark to a phase and moves the mark on. Group timing is per thread, so the load of
+// each 'omp for nowait' group can be compared across threads. The analyser's amplify and update
+// phases are nested within its analyser phase.
+// Allocation counts are of the solver's own blocks (aligned or mmap'd) and should be zero after setup.
+//
+//   solver.instrument.open(stderr, Instrument::Csv); // a row per generation
+//   solver.instrument.open(fp, Instrument::Json);    // an object per generation (json lines)
+
+#ifndef PSYCHICSNIFFLE_INSTRUMENT_H
+#define PSYCHICSNIFFLE_INSTRUMENT_H
+
+#include <omp.h>
+#include <time.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+namespace util {
+
+inline uint64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// allocations made by the solver's blocks, and their bytes
+inline uint64_t &allocationCount() { static uint64_t n = 0; return n; }
+inline uint64_t &allocationBytes() { static uint64_t n = 0; return n; }
+
+#if defined(SNIFFLE_INSTRUMENT)
+
+struct Instrument
+{
+    enum Phase { Evaluate, Stats, Sampler, Elite, Analyser, Amplify, Update, Groups, Phases };
+    enum Format { Csv, Json };
+    const static int GroupCount = 7;
+
+    static const char *PhaseName(int p)
+    {
+        static const char *names[Phases] = {"evaluate", "stats", "sampler", "elite", "analyser", "amplify", "update", "groups"};
+        return names[p];
+    }
+
+    uint64_t phaseNs[Phases];
+    uint64_t rebuilds; // sampler rebuilds in the analyser
+    uint64_t allocs, allocBytes;
+
+    int threads;
+    std::vector<uint64_t> groupNs; // [threads][GroupCount]
+
+    FILE *fp;
+    Format format;
+    bool headed;
+
+#ifdef _OPENMP
+    static int ompMaxThreads() { return std::max(omp_get_max_threads(), omp_get_num_procs()); }
+    static int ompThreadNum() { return omp_get_thread_num(); }
+#else
+    static int ompMaxThreads() { return 1; }
+    static int ompThreadNum() { return 0; }
+#endif
+
+    Instrument() :
+        threads(ompMaxThreads()), groupNs(threads * GroupCount),
+        fp(0), format(Csv), headed(false)
+    {
+        clear();
+    }
+
+    void open(FILE *fp_, Format format_)
+    {
+        fp = fp_;
+        format = format_;
+        headed = false;
+    }
+
+    void clear()
+    {
+        memset(phaseNs, 0, sizeof(phaseNs));
+        std::fill(groupNs.begin(), groupNs.end(), 0);
+        rebuilds = 0;
+        allocs = allocationCount();
+        allocBytes = allocationBytes();
+    }
+
+    void split(Phase p, uint64_t &mark)
+    {
+        const uint64_t now = nowNs();
+        phaseNs[p] += now - mark;
+        mark = now;
+    }
+
+    void group(int thread, int g, uint64_t &mark)
+    {
+        const uint64_t now = nowNs();
+        if (thread < threads) groupNs[thread * GroupCount + g] += now - mark;
+        mark = now;
+    }
+
+    // reports the generation, if open, and starts the next
+    void end(uint64_t generation)
+    {
+        if (fp) {
+            if (format == Csv)
+                writeCsv(generation);
+            else
+                writeJson(generation);
+            fflush(fp);
+        }
+        clear();
+    }
+
+    void writeCsv(uint64_t generation)
+    {
+        if (!headed) {
+            fprintf(fp, "generation");
+            for (int p = 0; p < Phases; p++) fprintf(fp, ",%s_ns", PhaseName(p));
+            fprintf(fp, ",rebuilds,allocs,alloc_bytes");
+            for (int g = 0; g < GroupCount; g++) fprintf(fp, ",g%d_max_ns,g%d_mean_ns", g + 1, g + 1);
+            fputc('\n', fp);
+            headed = true;
+        }
+        fprintf(fp, "%llu", (unsigned long long) generation);
+        for (int p = 0; p < Phases; p++) fprintf(fp, ",%llu", (unsigned long long) phaseNs[p]);
+        fprintf(fp, ",%llu,%llu,%llu", (unsigned long long) rebuilds,
+                (unsigned long long) (allocationCount() - allocs), (unsigned long long) (allocationBytes() - allocBytes));
+        for (int g = 0; g < GroupCount; g++) {
+            uint64_t max = 0, sum = 0;
+            for (int t = 0; t < threads; t++) {
+                max = std::max(max, groupNs[t * GroupCount + g]);
+                sum += groupNs[t * GroupCount + g];
+            }
+            fprintf(fp, ",%llu,%llu", (unsigned long long) max, (unsigned long long) (sum / threads));
+        }
+        fputc('\n', fp);
+    }
+
+    void writeJson(uint64_t generation)
+    {
+        fprintf(fp, "{\"generation\":%llu,\"phase_ns\":{", (unsigned long long) generation);
+        for (int p = 0; p < Phases; p++)
+            fprintf(fp, "%s\"%s\":%llu", p ? "," : "", PhaseName(p), (unsigned long long) phaseNs[p]);
+        fprintf(fp, "},\"rebuilds\":%llu,\"allocs\":%llu,\"alloc_bytes\":%llu,\"group_ns\":[", (unsigned long long) rebuilds,
+                (unsigned long long) (allocationCount() - allocs), (unsigned long long) (allocationBytes() - allocBytes));
+        for (int t = 0; t < threads; t++) {
+            fprintf(fp, "%s[", t ? "," : "");
+            for (int g = 0; g < GroupCount; g++)
+                fprintf(fp, "%s%llu", g ? "," : "", (unsigned long long) groupNs[t * GroupCount + g]);
+            fputc(']', fp);
+        }
+        fprintf(fp, "]}\n");
+    }
+};
+
+#define SNIFFLE_MARK(m) uint64_t m = util::nowNs()
+#define SNIFFLE_SPLIT(inst, phase, m) do { if (inst) (inst)->split(util::Instrument::phase, m); } while (0)
+#define SNIFFLE_GROUP(inst, g, m) do { if (inst) (inst)->group(util::Instrument::ompThreadNum(), g, m); } while (0)
+#define SNIFFLE_COUNT(inst, counter) do { if (inst) { _Pragma("omp atomic") (inst)->counter++; } } while (0)
+#define SNIFFLE_END(inst, generation) do { if (inst) (inst)->end(generation); } while (0)
+#define SNIFFLE_ALLOC(bytes) do { util::allocationCount()++; util::allocationBytes() += (bytes); } while (0)
+
+#else
+
+#define SNIFFLE_MARK(m)
+#define SNIFFLE_SPLIT(inst, phase, m)
+#define SNIFFLE_GROUP(inst, g, m)
+#define SNIFFLE_COUNT(inst, counter)
+#define SNIFFLE_END(inst, generation)
+#define SNIFFLE_ALLOC(bytes)
+
+#endif
+
+}
+
+#endif //PSYCHICSNIFFLE_INSTRUMENT_H
@@ -0,0 +1,230 @@
+// copyright 2016 john howard (orthopteroid@gmail.com)
+// MIT license
+//
+// Island model: K independent maximizers, each with its own PRNG state and analyser, run on their
+// own std::thread (and OpenMP team). Every Interval generations an island sends its Migrants fittest
+// individuals along each of its outbound links; immigrants replace the weakest of the receiving
+// population before its next crank. Links between islands of one process are lock-free SPSC rings,
+// so an island never waits on another, and a full ring drops the migrants. Islands in other
+// processes or hosts are reached by attaching a transport (see transport.h) to an island.
+//
+// A process running a single maximizer can be an island too, with a Migration and its own loop:
+//   Migration migration;
+//   migration.attach(openTransport("tcp:host:5555", solver.StateSize), true, true);
+//   ... solver.evaluate(fn); migration.exchange(solver, t); solver.crank(); ...
+//
+// Seeded islands are seeded apart, but migrants arrive when they arrive, so seeded island runs
+// are not repeatable the way a single seeded maximizer is.
+//
+//   Islands<FieldAnalyser> islands(4, 400, stateSize, schema);
+//   islands.Migrants = 4;
+//   islands.connect(Islands<FieldAnalyser>::BiRing);
+//   int k = islands.solve(fn, [](int island, uint t, float_t *f) -> bool { ... }); // island with the best
+
+#ifndef PSYCHICSNIFFLE_ISLANDS_H
+#define PSYCHICSNIFFLE_ISLANDS_H
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "sniffle.h"
+#include "transport.h"
+
+namespace sniffle {
+
+// One island's links: migrants are received from every inbound transport and, every Interval
+// generations, the Migrants fittest are sent along every outbound one.
+struct Migration {
+    uint Interval = 20;
+    uint Migrants = 2;
+
+    std::vector<std::shared_ptr<Transport>> outbound, inbound;
+    std::vector<int> idx;
+    std::vector<uint8_t> scratch;
+
+    void attach(std::shared_ptr<Transport> t, bool send, bool receive) {
+        if (send) outbound.push_back(t);
+        if (receive) inbound.push_back(t);
+    }
+
+    // call between evaluate() and crank(), with the generation
+    template<typename StateAnalyser>
+    void exchange(DynamicMaximizer<StateAnalyser> &m, uint t) {
+        scratch.resize(m.StateSize);
+        for (auto &link : inbound) {
+            float_t f;
+            while (link->receive(f, scratch.data()))
+                m.immigrate(scratch.data(), f);
+        }
+
+        if (Interval && t % Interval == Interval - 1) {
+            idx.resize(std::max(Migrants, 1u));
+            const int n = m.fittest(idx.data(), Migrants);
+            for (auto &link : outbound)
+                for (int j = 0; j < n; j++)
+                    if (!link->send(m.e[idx[j]], m.oldPop(idx[j]))) break;
+        }
+    }
+};
+
+template<typename StateAnalyser = ByteAnalyser>
+struct Islands {
+    typedef DynamicMaximizer<StateAnalyser> Island;
+
+    // Ring: k sends to k+1. BiRing: k sends to k-1 and k+1. Full: k sends to every other island.
+    enum Topology { Ring, BiRing, Full };
+
+    const uint Count;
+    const uint StateSize;
+    uint Interval;         // generations between migrations, 0 for none
+    uint Migrants;         // individuals sent along each link per migration
+    int threadsPerIsland;  // the OpenMP team size within each island
+    bool pin;              // pin island k's threads to cpus [k * threadsPerIsland, (k + 1) * threadsPerIsland)
+
+    std::vector<std::unique_ptr<Island>> island;
+    std::vector<Migration> migration;
+    std::vector<std::shared_ptr<Transport>> rings; // the links made by connect()
+    std::vector<int> bestIndex;     // per island, into the current population, as of the last evaluate
+    std::vector<float_t> bestFitness;
+
+    // islands are constructed here, on the calling thread, so unseeded PRNG state comes from rand() in turn
+    Islands(uint count, uint population, uint stateSize, const StateAnalyser &prototype = StateAnalyser()) :
+        Count(count), StateSize(stateSize), Interval(20), Migrants(2),
+        threadsPerIsland(1), pin(false),
+        migration(count), bestIndex(count, 0), bestFitness(count, 0)
+    {
+        if (Count == 0)
+            throw new std::runtime_error("no islands");
+        for (uint k = 0; k < Count; k++)
+            island.push_back(std::unique_ptr<Island>(new Island(population, stateSize, prototype)));
+#ifdef _OPENMP
+        threadsPerIsland = std::max(1, omp_get_num_procs() / (int) Count);
+#endif
+        connect(Ring);
+    }
+
+    // island k gets the seed's k'th derivation
+    void seed(uint64_t s) {
+        for (uint k = 0; k < Count; k++)
+            island[k]->seed(Taus88State::mix64(s + k));
+    }
+
+    void reset() {
+        for (uint k = 0; k < Count; k++)
+            island[k]->reset();
+    }
+
+    // Replaces the links between islands, but not attached transports. Rings hold two migrations,
+    // so set Migrants first.
+    void connect(Topology topology) {
+        auto local = [this](const std::shared_ptr<Transport> &t) { return std::find(rings.begin(), rings.end(), t) != rings.end(); };
+        for (auto &mig : migration) {
+            mig.outbound.erase(std::remove_if(mig.outbound.begin(), mig.outbound.end(), local), mig.outbound.end());
+            mig.inbound.erase(std::remove_if(mig.inbound.begin(), mig.inbound.end(), local), mig.inbound.end());
+        }
+        rings.clear();
+        for (int k = 0; k < (int) Count; k++) {
+            for (int j = 0; j < (int) Count; j++) {
+                if (j == k) continue;
+                const bool next = j == (k + 1) % (int) Count, prev = k == (j + 1) % (int) Count;
+                if (topology == Ring && !next) continue;
+                if (topology == BiRing && !next && !prev) continue;
+                std::shared_ptr<Transport> ring = std::make_shared<RingTransport>(StateSize, 2 * std::max(Migrants, 1u));
+                rings.push_back(ring);
+                migration[k].attach(ring, true, false);
+                migration[j].attach(ring, false, true);
+            }
+        }
+    }
+
+    // links island k with an island elsewhere; the transport is only used from island k's thread
+    void attach(int k, std::shared_ptr<Transport> t, bool send = true, bool receive = true) {
+        migration[k].attach(t, send, receive);
+    }
+
+    // Runs every island until the terminator, called as terminator(island, iteration, f) from that
+    // island's thread, returns true for any one of them. The terminator must be thread-safe.
+    // Returns the island holding the best individual, at bestIndex[island].
+    template<typename Fn, typename Terminator>
+    int solve(Fn fn, Terminator terminator) {
+        std::atomic<bool> stop(false);
+        std::runtime_error *error = 0;
+        std::atomic_flag erring = ATOMIC_FLAG_INIT;
+
+        std::vector<std::thread> threads;
+        for (int k = 0; k < (int) Count; k++) {
+            threads.push_back(std::thread([&, k]() {
+                try {
+                    if (pin) pinThread(k);
+                    run(k, fn, terminator, stop);
+                } catch (std::runtime_error *err) {
+                    if (!erring.test_and_set()) error = err;
+                    stop = true;
+                }
+            }));
+        }
+        for (auto &t : threads) t.join();
+        if (error) throw error;
+
+        int best = 0;
+        for (int k = 1; k < (int) Count; k++)
+            if (bestFitness[k] > bestFitness[best]) best = k;
+        return best;
+    }
+
+    uint8_t *best(int k) { return island[k]->oldPop(bestIndex[k]); }
+
+private:
+    template<typename Fn, typename Terminator>
+    void run(int k, Fn &fn, Terminator &terminator, std::atomic<bool> &stop) {
+#ifdef _OPENMP
+        omp_set_num_threads(std::min(threadsPerIsland, island[k]->taus88State.threads)); // this thread's teams only
+#endif
+        Island &m = *island[k];
+        migration[k].Interval = Interval;
+        migration[k].Migrants = Migrants;
+        int idx[1];
+
+        // stopping is only checked between evaluate and crank, so the evaluated generation (and
+        // bestIndex into it) is the one left in place
+        for (uint t = 0; ; t++) {
+            float_t *f = m.evaluate(fn);
+
+            m.fittest(idx, 1);
+            bestIndex[k] = idx[0];
+            bestFitness[k] = f[idx[0]];
+            if (terminator(k, t, f)) {
+                stop = true;
+                break;
+            }
+            if (stop.load(std::memory_order_relaxed)) break; // another island's terminator
+
+            migration[k].exchange(m, t);
+            m.crank();
+        }
+    }
+
+    // OpenMP teams started from a pinned thread inherit its cpus
+    void pinThread(int k) {
+#if defined(__linux__)
+        const int cpus = (int) std::thread::hardware_concurrency();
+        if (cpus <= 0) return;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int c = 0; c < threadsPerIsland; c++)
+            CPU_SET((k * threadsPerIsland + c) % cpus, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+    }
+};
+
+}
+
+#endif //PSYCHICSNIFFLE_ISLANDS_H
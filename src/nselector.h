@@ -31,7 +31,7 @@ struct NSelector
             throw new std::runtime_error("too many selections");
 
         repick:
-        uint a = fnRand() % N;
+        uint a = fnRand.bounded(N);
         for(int i=0; i<selected; i++)
         {
             if(a == n[i]) { goto repick; }
@@ -39,6 +39,27 @@ struct NSelector
         n[selected++] = a;
         return a;
     }
+
+    // selects from a weighted sampler, without replacement when possible.
+    // weights may be concentrated on fewer than M indices, so repeats are eventually accepted.
+    template<typename Sampler>
+    uint select(Taus88 &fnRand, const Sampler &sampler)
+    {
+        if(selected == M)
+            throw new std::runtime_error("too many selections");
+
+        uint a;
+        for(int attempt=0; attempt<8; attempt++)
+        {
+            a = sampler.sample(fnRand);
+            bool repeat = false;
+            for(int i=0; i<selected; i++)
+                repeat |= (a == n[i]);
+            if(!repeat) break;
+        }
+        n[selected++] = a;
+        return a;
+    }
 };
 
 }
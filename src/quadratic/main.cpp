@@ -28,16 +28,24 @@ timespec diff(timespec start, timespec end)
     return temp;
 }
 
-template<uint Population>
 struct Quadratic
 {
-    float_t f[Population];
-    Maximizer<float, Population, ByteAnalyser> solver;
+    DynamicMaximizer<ByteAnalyser> solver;
 
     using Rep = float;
 
     constexpr static float mu = 101.10101f; // target
 
+    // the population is sized at runtime
+    Quadratic(uint population, const char *seed) : solver(population, sizeof(Rep))
+    {
+        if( seed ) solver.seed( strtoull( seed, nullptr, 0 ) ); // repeatable runs
+
+#if defined(SNIFFLE_INSTRUMENT)
+        solver.instrument.open( stderr, Instrument::Csv ); // a timing row per generation
+#endif
+    }
+
     static float_t Eval(const float& x)
     {
         if( isnanf(x) ) return 0.f;
@@ -47,40 +55,38 @@ struct Quadratic
 
     void Solve()
     {
-        for( int p=0; p<Population; p++ )
-            solver.GetStateArr()[p] = ((float)((rand() % 20000))) - 10000;
+        float *x = (float*)solver.GetStateArr();
+        for( int p=0; p<solver.Population; p++ )
+            x[p] = ((float)((rand() % 20000))) - 10000;
 
-        uint iterations = 1;
         solver.reset();
 
+        // wall time, as process cpu time is summed over all threads
         timespec time1, time2;
-        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time1);
-
-        while( true ) {
-#pragma omp for
-            for( int p=0; p<Population; p++ )
-                f[p] = Eval( solver.GetStateArr()[p] );
+        clock_gettime(CLOCK_MONOTONIC, &time1);
 
-            solver.crank(f);
+        auto fnEval = [](uint8_t *p) -> float_t { return Eval( *(float*)p ); };
 
-            float percent = 100 * fabs(mu - *solver.GetStateArr()) / mu;
+        uint iterations = 1 + solver.solve(fnEval, [&](uint, float_t *) -> bool {
+            float percent = 100 * fabs(mu - *(float*)solver.GetStateArr()) / mu;
             //printf("%8.8f, ", percent );
-            if( percent < .01 ) break;
-            iterations++;
-        }
+            return percent < .01;
+        });
 
-        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time2);
+        clock_gettime(CLOCK_MONOTONIC, &time2);
 
-        printf("%8.8f, ", *solver.GetStateArr() );
-        if(diff(time1,time2).tv_sec == 0)
-            std::cout<<diff(time1,time2).tv_nsec / 1e6 / iterations << ", " << iterations << ", OK\n";
-        else
-            std::cout << "0, 0, ERR\n";
+        timespec elapsed = diff(time1,time2);
+        printf("%8.8f, ", *(float*)solver.GetStateArr() );
+        std::cout << (elapsed.tv_sec * 1e3 + elapsed.tv_nsec / 1e6) / iterations << ", " << iterations << ", OK\n";
     }
 };
 
-int main()
+// usage: quadratic [population [seed]]
+int main(int argc, char *argv[])
 {
+    uint population = argc > 1 ? (uint)atoi(argv[1]) : 60000;
+    const char *seed = argc > 2 ? argv[2] : nullptr;
+
     srand(int(time(NULL)));
 
 #if defined(NDEBUG)
@@ -91,12 +97,12 @@ int main()
     }
 #endif
 
-    printf("Maximize Quadratic. Target = %f\n", Quadratic<60000>::mu);
+    printf("Maximize Quadratic. Population = %u, Target = %f\n", population, Quadratic::mu);
 
     for(int i=0;i<10;i++)
     {
         {
-            Quadratic<60000> solver;
+            Quadratic solver(population, seed);
             solver.Solve();
         }
     }
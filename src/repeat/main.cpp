@@ -0,0 +1,203 @@
+// copyright 2016 john howard (orthopteroid@gmail.com)
+// MIT license
+//
+// Repeatability test: a seeded solver is run twice at each of two thread counts, and the final
+// populations and fitnesses must match byte for byte. Every slot of a generation has to be bred from
+// the seeded streams, so a slot that is skipped or left with leftover heap bytes shows up here. Before
+// each run the heap is dirtied with a different byte, so leftover bytes differ between runs.
+//
+// Checkpoints are tested the same way: a run saved part way and restored into a fresh solver must
+// finish as the uninterrupted run does, including when it is split just before a generation that
+// negates the distributions. Restoring into a solver with another field schema must be refused.
+//
+// usage: sniffle_repeat [generations [threads]]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "sniffle.h"
+
+using namespace sniffle;
+
+//////////////////////////////
+
+const uint Population = 300;
+const uint Genes = 8;
+const uint64_t Seed = 12345;
+
+// rastrigin over 16-bit genes, negated to be maximized
+float_t fnEval(uint8_t *p)
+{
+    float_t sum = 10.f * Genes;
+    for (uint d = 0; d < Genes; d++) {
+        uint16_t g;
+        memcpy(&g, p + d * sizeof(uint16_t), sizeof(g));
+        const float_t x = -5.12f + 10.24f * (float_t) g / 65535.f;
+        sum += x * x - 10.f * cosf(2.f * (float_t) M_PI * x);
+    }
+    return -sum;
+}
+
+// fill and free blocks of the sizes the solver's arena comes in, so it starts on these bytes
+void dirtyHeap(uint8_t fill)
+{
+    std::vector<void *> blocks;
+    for (size_t bytes = 4096; bytes <= (2u << 20); bytes *= 2) {
+        void *p = malloc(bytes);
+        memset(p, fill, bytes);
+        blocks.push_back(p);
+    }
+    for (void *p : blocks) free(p);
+}
+
+struct Result
+{
+    std::vector<uint8_t> states;
+    std::vector<float_t> fitness;
+};
+
+template<typename StateAnalyser>
+Result finish(DynamicMaximizer<StateAnalyser> &solver)
+{
+    float_t *f = solver.evaluate(fnEval);
+
+    Result r;
+    r.states.assign(solver.GetStateArr(), solver.GetStateArr() + (size_t) Population * solver.StateSize);
+    r.fitness.assign(f, f + Population);
+    return r;
+}
+
+template<typename StateAnalyser>
+Result run(int threads, uint generations, const StateAnalyser &prototype, uint8_t fill)
+{
+    dirtyHeap(fill);
+#ifdef _OPENMP
+    omp_set_num_threads(threads); // before the solver sizes its prng state
+#endif
+    DynamicMaximizer<StateAnalyser> solver(Population, Genes * sizeof(uint16_t), prototype);
+    solver.seed(Seed);
+    solver.reset();
+    for (uint g = 0; g < generations; g++) {
+        solver.evaluate(fnEval);
+        solver.crank();
+    }
+    return finish(solver);
+}
+
+// as run(), but saved after split generations and restored into a fresh solver to finish
+template<typename StateAnalyser>
+Result resume(int threads, uint split, uint generations, const StateAnalyser &prototype)
+{
+#ifdef _OPENMP
+    omp_set_num_threads(threads);
+#endif
+    FILE *fp = tmpfile();
+    if (!fp) throw new std::runtime_error("checkpoint file failed");
+    {
+        DynamicMaximizer<StateAnalyser> solver(Population, Genes * sizeof(uint16_t), prototype);
+        solver.seed(Seed);
+        solver.reset();
+        for (uint g = 0; g < split; g++) {
+            solver.evaluate(fnEval);
+            solver.crank();
+        }
+        solver.save(fp);
+    }
+    dirtyHeap(0x3c);
+    rewind(fp);
+
+    DynamicMaximizer<StateAnalyser> solver(Population, Genes * sizeof(uint16_t), prototype);
+    solver.restore(fp);
+    fclose(fp);
+    for (uint g = split; g < generations; g++) {
+        solver.evaluate(fnEval);
+        solver.crank();
+    }
+    return finish(solver);
+}
+
+// a checkpoint restored into a solver with another analyser schema has to be refused
+bool rejects(const FieldAnalyser &saved, const FieldAnalyser &other)
+{
+    FILE *fp = tmpfile();
+    if (!fp) throw new std::runtime_error("checkpoint file failed");
+    DynamicMaximizer<FieldAnalyser> solver(Population, Genes * sizeof(uint16_t), saved);
+    solver.seed(Seed);
+    solver.reset();
+    solver.save(fp);
+    rewind(fp);
+
+    DynamicMaximizer<FieldAnalyser> mismatched(Population, Genes * sizeof(uint16_t), other);
+    bool refused = false;
+    try {
+        mismatched.restore(fp);
+    } catch (std::runtime_error *err) {
+        refused = true;
+        delete err;
+    }
+    fclose(fp);
+    printf("field schema mismatch: %s\n", refused ? "OK" : "FAILED, the checkpoint was restored");
+    return refused;
+}
+
+// the first individual that differs, or -1
+int compare(const Result &a, const Result &b, uint stateSize)
+{
+    for (uint i = 0; i < Population; i++)
+        if (memcmp(&a.states[i * stateSize], &b.states[i * stateSize], stateSize) ||
+            memcmp(&a.fitness[i], &b.fitness[i], sizeof(float_t)))
+            return (int) i;
+    return -1;
+}
+
+template<typename StateAnalyser>
+bool check(const char *name, int threads, uint generations, const StateAnalyser &prototype)
+{
+    const Result runs[] = {
+        run(1, generations, prototype, 0x00), run(1, generations, prototype, 0x5a),
+        run(threads, generations, prototype, 0xa5), run(threads, generations, prototype, 0xff)
+    };
+    const int runThreads[] = {1, 1, threads, threads};
+
+    bool ok = true;
+    for (int k = 1; k < 4; k++) {
+        const int i = compare(runs[0], runs[k], Genes * sizeof(uint16_t));
+        if (i >= 0) {
+            printf("%s: the run at %d threads differs from the first at 1 thread, from individual %d\n", name, runThreads[k], i);
+            ok = false;
+        }
+    }
+
+    // the analysers negate every 10th crank, so a split at 9 resumes into a negate generation
+    const uint splits[] = {std::min(9u, generations), generations / 2};
+    for (uint split : splits) {
+        const int i = compare(runs[0], resume(threads, split, generations, prototype), Genes * sizeof(uint16_t));
+        if (i >= 0) {
+            printf("%s: the run restored after %u generations differs, from individual %d\n", name, split, i);
+            ok = false;
+        }
+    }
+    printf("%s: %s\n", name, ok ? "OK" : "FAILED");
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const uint generations = argc > 1 ? (uint) atoi(argv[1]) : 40;
+    const int threads = argc > 2 ? atoi(argv[2]) : 3;
+
+    FieldAnalyser schema;
+    schema.add({0, 16, false}, Genes, 16);
+
+    FieldAnalyser categorical;
+    categorical.add({0, 16, true}, Genes, 16);
+
+    bool ok = check("byte", threads, generations, ByteAnalyser());
+    ok &= check("field", threads, generations, schema);
+    ok &= rejects(schema, categorical);
+    return ok ? 0 : 1;
+}
@@ -1,51 +1,144 @@
 // copyright 2016 john howard (orthopteroid@gmail.com)
 // MIT license
 //
-// Performs a normalization and a prefix sum on the input array.
-// Input and output arrays can use mismatched numeric types.
+// Walker/Vose alias-method sampler.
+// The input array is normalized by its minimum (when all values are equal the distribution is uniform)
+// and split into N equal-probability columns, each holding at most two indices.
+// Building is O(N) and sampling is O(1), without the quantization of an expanded lookup table.
+// Index and weight arrays can use mismatched numeric types; the index type bounds N.
 
 #ifndef PROJECT_SAMPLERTABLE_H
 #define PROJECT_SAMPLERTABLE_H
 
+#include <algorithm>
+#include <cmath>
+
+#include "arena.h"
+#include "taus88.h"
+
 namespace util {
 
-template<typename OT, uint ON, typename IT, uint IN>
-int buildSamplerTable(OT* outArr, IT* inArr)
+// A view over caller-owned storage, so tables can be carved from an arena or packed into
+// a larger array (one table per channel, say).
+template<typename IT>
+struct AliasTable
 {
-    IT min = inArr[0];
-    for(int i=1; i<IN; i++) {
-        min = std::min(min, inArr[i]);
-    }
+    const static uint ParallelN = 1 << 16; // tables at least this large are built in parallel, where possible
+
+    uint N;
+    float_t *prob; // [N] probability of keeping the column's own index
+    IT *alias;     // [N] the column's other index
 
-    // compute area
-    float_t sum = 0;
-    for(int i=0; i<IN; i++) {
-        sum += (inArr[i] - min);
+    AliasTable() : N(0), prob(0), alias(0) {}
+    AliasTable(uint N_, float_t *prob_, IT *alias_) : N(N_), prob(prob_), alias(alias_) {}
+
+    void layout(Arena &arena, uint n)
+    {
+        N = n;
+        prob = arena.alloc<float_t>(n);
+        alias = arena.alloc<IT>(n);
     }
 
-    // when all equal, return a uniform distr
-    if (sum == 0) {
-        for(int i=0; i<IN; i++)
-            outArr[i] = i;
-        return IN;
+    void uniform()
+    {
+        auto fnUniform = [this](int i) {
+            prob[i] = 1.f;
+            alias[i] = i;
+        };
+        if (N >= ParallelN) {
+#pragma omp parallel for
+            for (int i = 0; i < N; i++) fnUniform(i);
+        } else {
+            for (int i = 0; i < N; i++) fnUniform(i);
+        }
     }
 
-    // select a scaling coef such that output outArr is filled
-    float_t coef = (float)(ON -1) / sum;
+    // work is scratch space for N indices
+    template<typename VT>
+    void build(const VT *inArr, IT *work)
+    {
+        VT min = inArr[0];
+        for (uint i = 1; i < N; i++)
+            min = std::min(min, inArr[i]);
+
+        // compute area
+        double sum = 0;
+        for (uint i = 0; i < N; i++)
+            sum += (inArr[i] - min);
 
-    // otherwise return a nonuniform distribution
-    uint i = 0;
-    for (uint j = 0; j < IN; j++) {
-        uint expectedValue = ( (float_t)(inArr[j]) - (float_t)min ) * coef;
-        for (uint k = 0; k < expectedValue; k++)
-            outArr[i++] = j;
+        build(inArr, min, sum, work);
     }
 
-    if (i == 0 || i > ON)
-        throw new std::runtime_error("outArr error");
+    // build from a precomputed minimum and area (the sum of inArr[i] - min)
+    template<typename VT>
+    void build(const VT *inArr, const VT min, const double sum, IT *work)
+    {
+        // when all equal, return a uniform distr
+        if (sum <= 0) {
+            uniform();
+            return;
+        }
 
-    return i;
-}
+        // scale so the average column is 1
+        const double coef = (double) N / sum;
+        auto fnScale = [&](int i) { prob[i] = (float_t) (((double) inArr[i] - (double) min) * coef); };
+        if (N >= ParallelN) {
+#pragma omp parallel for
+            for (int i = 0; i < N; i++) fnScale(i);
+        } else {
+            for (int i = 0; i < N; i++) fnScale(i);
+        }
+
+        // partition into small and large stacks, which share the work array from either end
+        uint small = 0, large = N;
+        for (uint i = 0; i < N; i++) {
+            if (prob[i] < 1.f)
+                work[small++] = i;
+            else
+                work[--large] = i;
+        }
+
+        // top up each small column from a large one.
+        // the residual of the large column on top of the stack is carried in double precision,
+        // as it can be many columns wide with large N.
+        uint top = N;
+        double residual = 0;
+        while (small > 0 && large < N) {
+            IT l = work[large];
+            if (top != large) {
+                top = large;
+                residual = ((double) inArr[l] - (double) min) * coef;
+            }
+            IT s = work[--small];
+            alias[s] = l;
+            residual = (residual + prob[s]) - 1.0;
+            if (residual < 1.0) {
+                prob[l] = (float_t) residual;
+                large++;
+                work[small++] = l;
+            }
+        }
+
+        // what remains is full, up to rounding
+        while (large < N) {
+            IT l = work[large++];
+            prob[l] = 1.f;
+            alias[l] = l;
+        }
+        while (small > 0) {
+            IT s = work[--small];
+            prob[s] = 1.f;
+            alias[s] = s;
+        }
+    }
+
+    uint sample(Taus88 &fnRand) const
+    {
+        uint i = fnRand.bounded(N);
+        const float_t coin = (float_t) (fnRand() >> 8) * (1.f / 16777216.f); // 24 bits, [0,1)
+        return coin < prob[i] ? i : alias[i];
+    }
+};
 
 }
 
@@ -31,48 +31,41 @@ struct Schwefel
         return sum - 418.9829 * Dimension;
     }
 
-    static void Solve(int solns)
+    const static uint Stall = 100; // generations without improvement
+
+    static void Solve(int solns, const char *seed)
     {
         printf("Minimze Schwefel<%d> : https://www.sfu.ca/~ssurjano/schwef.html\n", Dimension);
 
-        float_t f[Population];
-        Maximizer<StateType, Population, ByteAnalyser> solver;
-
-        float_t best = 0.f;
-        uint i = 0;
-
-        uint t = 0;
-        solver.reset();
-        while( t < 1e6 ) {
-#pragma omp for
-            for( int p=0; p<Population; p++ )
-                f[p] = Eval( solver.GetStateArr()[p] );
-
-            if( t == 10000 || best != f[0] ) {
-                float ff = solver.stateAnalyser.calcSmallestChannelDifference();
-                best = f[0];
-                if( t == 10000 || ff >= .99f ) {
-                    printf("%u, %8.4f, %8.4f, [", t, best, ff);
-                    for( int d=0; d<Dimension; d++ ) {
-                        StateType &state = *solver.GetStateArr();
-                        double_t val = (float_t) 1000. * (float_t) state[d] / (float_t) ((Rep) ~0) - (float_t) 500.;
-                        printf("%8.8f%s ", val, d < Dimension - 1 ? "," : "]\n" );
-                    }
-                    fflush(stdout);
-                    t = 0;
-                    solver.reset();
-                    if( ++i == solns ) break;
-                    continue;
+        // each gene is tracked as one field, rather than as two unrelated bytes
+        FieldAnalyser schema;
+        schema.add({0, 8 * sizeof(Rep), false}, Dimension, 8 * sizeof(Rep));
+
+        Maximizer<StateType, Population, FieldAnalyser> solver(schema);
+        if( seed ) solver.seed( strtoull( seed, nullptr, 0 ) ); // repeatable runs
+
+        for( uint i = 0; i < solns; i++ ) {
+            solver.reset();
+            solver.solve(Eval, [&](uint t, float_t *f) -> bool {
+                // field distributions sharpen well before the best stops improving, so wait for a stall too
+                const ConvergenceStats &c = solver.convergence;
+                if( t != 10000 && ( c.stagnation < Stall || c.signalNoise < .99f ) ) return false;
+
+                printf("%u, %8.4f, %8.4f, [", t, f[0], c.signalNoise);
+                for( int d=0; d<Dimension; d++ ) {
+                    StateType &state = *solver.GetStateArr();
+                    double_t val = (float_t) 1000. * (float_t) state[d] / (float_t) ((Rep) ~0) - (float_t) 500.;
+                    printf("%8.8f%s ", val, d < Dimension - 1 ? "," : "]\n" );
                 }
-            }
-
-            solver.crank(f);
-            t++;
+                fflush(stdout);
+                return true;
+            });
         }
     }
 };
 
-int main()
+// usage: schwefel [seed]
+int main(int argc, char *argv[])
 {
     srand(int(time(NULL)));
 
@@ -84,7 +77,7 @@ int main()
     }
 #endif
 
-    Schwefel<uint16_t, 20, 400>::Solve(10);
+    Schwefel<uint16_t, 20, 400>::Solve(10, argc > 1 ? argv[1] : nullptr);
 
     return 0;
 }
@@ -7,12 +7,19 @@
 #define PSYCHICSNIFFLE_SNIFFLE_H
 
 #include <iostream>
+#include <cstdio>
 #include <cmath>
 #include <cstring>
+#include <string>
 #include <omp.h>
 #include <functional>
+#include <algorithm>
+#include <vector>
 #include <assert.h>
 
+#include "arena.h"
+#include "bytedistr.h"
+#include "instrument.h"
 #include "nselector.h"
 #include "samplertable.h"
 #include "splice.h"
@@ -24,103 +31,131 @@ using namespace util;
 
 namespace sniffle {
 
+inline void checkpointWrite(FILE *fp, const void *p, size_t n) {
+    if (fwrite(p, 1, n, fp) != n)
+        throw new std::runtime_error("checkpoint write failed");
+}
+
+inline void checkpointRead(FILE *fp, void *p, size_t n) {
+    if (fread(p, 1, n, fp) != n)
+        throw new std::runtime_error("checkpoint read failed");
+}
+
+//////////////////////////////////
+
 // The byte-analyser constructs distributions of the population's state bytes
 // for byte-level gene selection and jump-mutation.
-template<typename StateType>
 struct ByteAnalyser {
-    const static int StateSize = sizeof(StateType);
+    const static uint Slabs = 8; // elite samples are split over this many delta slabs
+    const static uint RebuildDrift = 32; // a channel's sampler is rebuilt once it drifts 1/RebuildDrift of its area
+
+    uint StateSize;
 
-    uint8_t *GetByteArr(StateType &state) { return (uint8_t *) &state; }
+    uint8_t *distr;       // [StateSize][256]
+    uint8_t *delta;       // [Slabs][StateSize][256], amplification accumulated from the elites
+    float_t *dProb;       // [StateSize][256], alias sampler per channel
+    uint8_t *dAlias;      // [StateSize][256]
+    uint8_t *dBuilt;      // [StateSize][256], each channel less its minimum when its sampler was built
+    uint32_t *dArea;      // [StateSize], and the area it was built with
 
-    uint8_t distr[StateSize][256];
-    uint8_t dSampler[StateSize][65535];
-    uint16_t dSamplerN[StateSize];
+    // per-channel convergence, kept up by crank()
+    uint8_t *chMin, *chMax; // [StateSize]
+    float_t *chEntropy;     // [StateSize], normalized, as of the channel's last sampler build
 
     // local-maxima strategy: occasionally invert byte distributions
     int iteration;
     bool negated;
 
+#if defined(SNIFFLE_INSTRUMENT)
+    Instrument *instrument = 0;
+#endif
+
+    uint8_t *GetDistr(int ss) { return distr + ss * 256; }
+
+    AliasTable<uint8_t> GetSampler(int ss) { return AliasTable<uint8_t>(256, dProb + ss * 256, dAlias + ss * 256); }
+
+    void layout(Arena &arena, uint stateSize) {
+        StateSize = stateSize;
+        distr = arena.alloc<uint8_t>(StateSize * 256);
+        delta = arena.alloc<uint8_t>((size_t) Slabs * StateSize * 256);
+        dProb = arena.alloc<float_t>(StateSize * 256);
+        dAlias = arena.alloc<uint8_t>(StateSize * 256);
+        dBuilt = arena.alloc<uint8_t>(StateSize * 256);
+        dArea = arena.alloc<uint32_t>(StateSize);
+        chMin = arena.alloc<uint8_t>(StateSize);
+        chMax = arena.alloc<uint8_t>(StateSize);
+        chEntropy = arena.alloc<float_t>(StateSize);
+    }
+
     void dumpStats() {
         for (int ss = 0; ss < StateSize; ss++) {
-            for (int b = 0; b < 256; b++) putchar('A' + 25 * (distr[ss][b]) / 255);
+            for (int b = 0; b < 256; b++) putchar('A' + 25 * (GetDistr(ss)[b]) / 255);
             putchar('\n');
         }
         putchar('\n');
     }
 
-    float_t calcSmallestChannelDifference()
-    {
-        uint8_t min[StateSize], max[StateSize];
-
-#pragma omp parallel for
-        for (int ss = 0; ss < StateSize; ss++)
-        {
-            min[ss] = 255;
-            max[ss] = 0;
-            for (int b = 0; b < 256; b++) {
-                min[ss] = std::min(min[ss], distr[ss][b]);
-                max[ss] = std::max(max[ss], distr[ss][b]);
-            }
-        }
-
-        // smallest difference between channels
-        uint8_t deltaE = (uint8_t)~0;
-        for (int s1 = 0; s1 < StateSize; s1++)
-            for (int s2 = 0; s2 < StateSize; s2++)
-                deltaE = std::min(deltaE, (uint8_t)(max[s1] - min[s2]));
+    // O(StateSize), from the channel ranges of the last crank
+    float_t calcSmallestChannelDifference() { return smallestChannelDifference(chMin, chMax, StateSize); }
 
-        return (float_t)deltaE / 255.f;
+    float_t calcEntropy() {
+        float_t sum = 0;
+        for (int ss = 0; ss < StateSize; ss++) sum += chEntropy[ss];
+        return sum / StateSize;
     }
 
-    void crank(StateType *stateArr, int *eliteArr, const int eliteSamples) {
+    void crank(uint8_t *stateArr, int *eliteArr, const int eliteSamples) {
 #if 0
         dumpStats();
 #endif
 
-        if( ++iteration % 10 == 0 ) {
-            negated = true;
-
-#pragma omp parallel for
-            for (int ss = 0; ss < StateSize; ss++)
-                for (int b = 0; b < 256; b++)
-                    distr[ss][b] = ~distr[ss][b];
-        } else {
-            if( negated ) {
-                negated = !negated;
-#pragma omp parallel for
-                for (int ss = 0; ss < StateSize; ss++)
-                    for (int b = 0; b < 256; b++)
-                        distr[ss][b] = ~distr[ss][b];
-            }
-
-            // attenuate - BREATHE OUT
-#pragma omp parallel for
-            for (int ss = 0; ss < StateSize; ss++)
-                for (int b = 0; b < 256; b++)
-                    if (distr[ss][b] > 1) distr[ss][b] -= 1;
+        const bool negate = ++iteration % 10 == 0;
+        const bool unnegate = !negate && negated;
+        negated = negate;
 
+        SNIFFLE_MARK(mark);
+        const size_t slabStride = (size_t) StateSize * 256;
+        if (!negate) {
             // amplify by sampling from the elite group - BREATHE IN
-#pragma omp parallel for
-            for (int i = 0; i < eliteSamples; i++) {
-                for (int ss = 0; ss < StateSize; ss++) {
-                    int b = GetByteArr(stateArr[eliteArr[i]])[ss];
-                    if (distr[ss][b] < 250) distr[ss][b] += 5;
-
-                    // slightly distribute locality
-                    for (int bo = 1; bo < 4; bo++) {
-                        if (b > 0 && distr[ss][b - bo] < 250) distr[ss][b - bo] += 1;
-                        if (b < 255 && distr[ss][b + bo] < 250) distr[ss][b + bo] += 1;
-                    }
+            // each slab takes a fixed share of the elites, so no two threads touch the same bytes
+#pragma omp parallel for schedule(static)
+            for (int s = 0; s < Slabs; s++) {
+                uint8_t *slab = delta + s * slabStride;
+                for (int i = eliteSamples * s / Slabs; i < eliteSamples * (s + 1) / Slabs; i++) {
+                    const uint8_t *elite = stateArr + (size_t) eliteArr[i] * StateSize;
+                    for (int ss = 0; ss < StateSize; ss++)
+                        amplifyDelta(slab + ss * 256, elite[ss]);
                 }
             }
         }
 
-        // recalc
+        SNIFFLE_SPLIT(instrument, Amplify, mark);
+
+        // update and recalc, a channel at a time.
+        // on the way in the distribution is attenuated - BREATHE OUT - before the slabs are merged.
+        // most generations move a channel's shape only slightly, so samplers are rebuilt lazily.
 #pragma omp parallel for
         for (int ss = 0; ss < StateSize; ss++) {
-            dSamplerN[ss] = buildSamplerTable<uint8_t, 65535, uint8_t, 256>(&(dSampler[ss][0]), &(distr[ss][0]));
-        }
+            uint8_t *d = GetDistr(ss);
+            if (negate)
+                negateBytes(d, 256);
+            else
+                updateChannel(d, delta + ss * 256, slabStride, Slabs, unnegate);
 
+            uint sum;
+            channelRange(d, chMin[ss], chMax[ss]);
+            const uint8_t min = chMin[ss];
+            const uint drift = channelDrift(d, min, dBuilt + ss * 256, sum);
+            if (drift * RebuildDrift > dArea[ss]) {
+                uint8_t work[256];
+                dArea[ss] = sum - 256 * min;
+                GetSampler(ss).build(d, min, (double) dArea[ss], work);
+                channelSnapshot(dBuilt + ss * 256, d, min);
+                chEntropy[ss] = channelEntropy(dBuilt + ss * 256, dArea[ss]);
+                SNIFFLE_COUNT(instrument, rebuilds);
+            }
+        }
+        SNIFFLE_SPLIT(instrument, Update, mark);
     }
 
     void reset() {
@@ -131,23 +166,297 @@ struct ByteAnalyser {
         // on the convergence rate. A higher value will require more attenuation
         // cycles before the S/R ratio get stronger.
         memset(distr, UINT8_MAX >> 2, StateSize * 256); // a uniform distribution
+        memset(delta, 0, (size_t) Slabs * StateSize * 256);
+        memset(dBuilt, 0, StateSize * 256);
+        memset(dArea, 0, StateSize * sizeof(uint32_t));
+        memset(chMin, UINT8_MAX >> 2, StateSize);
+        memset(chMax, UINT8_MAX >> 2, StateSize);
 
 #pragma omp parallel for
         for (int ss = 0; ss < StateSize; ss++) {
-            for (int i = 0; i < 256; i++)
-                dSampler[ss][i] = i; // a uniform distribution
-            dSamplerN[ss] = ~0;
+            GetSampler(ss).uniform(); // a uniform distribution
+            chEntropy[ss] = 1;
         }
     }
 
+    // tables live in the arena, only the iteration state needs checkpointing
+    void save(FILE *fp) {
+        checkpointWrite(fp, &iteration, sizeof(iteration));
+        checkpointWrite(fp, &negated, sizeof(negated));
+    }
+
+    void restore(FILE *fp) {
+        checkpointRead(fp, &iteration, sizeof(iteration));
+        checkpointRead(fp, &negated, sizeof(negated));
+    }
+
+    // as above, for copying an analyser whose tables have been copied as arena bytes
+    void copyState(const ByteAnalyser &other) {
+        iteration = other.iteration;
+        negated = other.negated;
+    }
+
+    // identifies the analyser in a checkpoint, as its arena layout depends on it
+    uint32_t checkpointTag() const { return 'BYTE'; }
+
     void mutatebyte(uint8_t *p, Taus88& fnRand) {
-        int byte = fnRand() % StateSize;
-        p[byte] = dSampler[byte][ fnRand() % dSamplerN[byte] ]; // jump mutation - kudos to Andrew Schwartzmeyer
+        int byte = fnRand.bounded(StateSize);
+        p[byte] = GetSampler(byte).sample(fnRand); // jump mutation - kudos to Andrew Schwartzmeyer
     }
 
     void randomize(uint8_t *p, Taus88& fnRand) {
         for (int ss = 0; ss < StateSize; ss++) {
-            p[ss] = dSampler[ss][ fnRand() % dSamplerN[ss] ];
+            p[ss] = GetSampler(ss).sample(fnRand);
+        }
+    }
+};
+
+//////////////////////////////////
+
+// A bit-field of the state, for the field-analyser.
+// Bits are numbered from the least significant bit of the first state byte, which is how
+// gcc lays out bitfields on little-endian targets, and multi-byte fields are little-endian.
+struct BitField {
+    uint bitOffset;
+    uint bits;        // 1 to 16
+    bool categorical; // values are labels, so elites don't amplify neighbouring values
+};
+
+// The field-analyser constructs distributions per field of a schema, rather than per byte,
+// so packed fields are tracked separately and wide fields aren't split into independent bytes.
+// Fields wider than MaxModelBits are tracked over their high bits and their low bits are drawn uniformly.
+// Bits not in any field are randomized uniformly and never mutated.
+struct FieldAnalyser {
+    const static uint Slabs = 8; // elite samples are split over this many delta slabs
+    const static uint RebuildDrift = 32; // a field's sampler is rebuilt once it drifts 1/RebuildDrift of its area
+    const static uint MaxModelBits = 8;
+
+    std::vector<BitField> fields;
+    std::vector<uint> binOffset; // [fields + 1], where each field's bins start
+    uint StateSize = 0;
+    bool covered = false;        // every state bit is in a field
+
+    uint8_t *distr = 0;   // [bins]
+    uint8_t *delta = 0;   // [Slabs][bins], amplification accumulated from the elites
+    float_t *dProb = 0;   // [bins], alias sampler per field
+    uint8_t *dAlias = 0;  // [bins]
+    uint8_t *dBuilt = 0;  // [bins], each field less its minimum when its sampler was built
+    uint32_t *dArea = 0;  // [fields], and the area it was built with
+
+    // per-field convergence, kept up by crank()
+    uint8_t *chMin = 0, *chMax = 0; // [fields]
+    float_t *chEntropy = 0;         // [fields], normalized, as of the field's last sampler build
+
+    // local-maxima strategy: occasionally invert distributions
+    int iteration = 0;
+    bool negated = false;
+
+#if defined(SNIFFLE_INSTRUMENT)
+    Instrument *instrument = 0;
+#endif
+
+    FieldAnalyser() {}
+
+    // adds count fields, strideBits apart
+    FieldAnalyser &add(BitField f, uint count = 1, uint strideBits = 0) {
+        if (f.bits < 1 || f.bits > 16)
+            throw new std::runtime_error("unsupported field width");
+        for (uint k = 0; k < count; k++, f.bitOffset += strideBits)
+            fields.push_back(f);
+        return *this;
+    }
+
+    uint FieldCount() const { return fields.size(); }
+
+    uint ModelBits(int k) const { return fields[k].bits < MaxModelBits ? fields[k].bits : MaxModelBits; }
+
+    uint Bins(int k) const { return binOffset[k + 1] - binOffset[k]; }
+
+    uint8_t *GetDistr(int k) { return distr + binOffset[k]; }
+
+    AliasTable<uint8_t> GetSampler(int k) { return AliasTable<uint8_t>(Bins(k), dProb + binOffset[k], dAlias + binOffset[k]); }
+
+    static uint getBits(const uint8_t *p, uint bitOffset, uint bits) {
+        const uint8_t *q = p + bitOffset / 8;
+        const uint shift = bitOffset & 7, bytes = (shift + bits + 7) / 8;
+        uint32_t v = 0;
+        for (uint i = 0; i < bytes; i++) v |= (uint32_t) q[i] << (8 * i);
+        return (v >> shift) & ((1u << bits) - 1);
+    }
+
+    static void setBits(uint8_t *p, uint bitOffset, uint bits, uint val) {
+        uint8_t *q = p + bitOffset / 8;
+        const uint shift = bitOffset & 7, bytes = (shift + bits + 7) / 8;
+        const uint32_t mask = ((1u << bits) - 1) << shift;
+        uint32_t v = 0;
+        for (uint i = 0; i < bytes; i++) v |= (uint32_t) q[i] << (8 * i);
+        v = (v & ~mask) | ((val << shift) & mask);
+        for (uint i = 0; i < bytes; i++) q[i] = (uint8_t) (v >> (8 * i));
+    }
+
+    uint bin(const uint8_t *p, int k) const {
+        return getBits(p, fields[k].bitOffset, fields[k].bits) >> (fields[k].bits - ModelBits(k));
+    }
+
+    void layout(Arena &arena, uint stateSize) {
+        StateSize = stateSize;
+        if (fields.empty())
+            throw new std::runtime_error("field-analyser has no fields");
+
+        // check the schema against the state
+        std::vector<uint8_t> used(StateSize * 8, 0);
+        binOffset.assign(1, 0);
+        for (int k = 0; k < FieldCount(); k++) {
+            if (fields[k].bitOffset + fields[k].bits > StateSize * 8)
+                throw new std::runtime_error("field outside of state");
+            for (uint b = fields[k].bitOffset; b < fields[k].bitOffset + fields[k].bits; b++) {
+                if (used[b]++)
+                    throw new std::runtime_error("fields overlap");
+            }
+            binOffset.push_back(binOffset.back() + (1u << ModelBits(k)));
+        }
+        covered = std::find(used.begin(), used.end(), 0) == used.end();
+
+        const uint bins = binOffset.back();
+        distr = arena.alloc<uint8_t>(bins);
+        delta = arena.alloc<uint8_t>((size_t) Slabs * bins);
+        dProb = arena.alloc<float_t>(bins);
+        dAlias = arena.alloc<uint8_t>(bins);
+        dBuilt = arena.alloc<uint8_t>(bins);
+        dArea = arena.alloc<uint32_t>(FieldCount());
+        chMin = arena.alloc<uint8_t>(FieldCount());
+        chMax = arena.alloc<uint8_t>(FieldCount());
+        chEntropy = arena.alloc<float_t>(FieldCount());
+    }
+
+    void dumpStats() {
+        for (int k = 0; k < FieldCount(); k++) {
+            for (int b = 0; b < Bins(k); b++) putchar('A' + 25 * (GetDistr(k)[b]) / 255);
+            putchar('\n');
+        }
+        putchar('\n');
+    }
+
+    // O(fields), from the field ranges of the last crank
+    float_t calcSmallestChannelDifference() { return smallestChannelDifference(chMin, chMax, FieldCount()); }
+
+    float_t calcEntropy() {
+        float_t sum = 0;
+        for (int k = 0; k < FieldCount(); k++) sum += chEntropy[k];
+        return sum / FieldCount();
+    }
+
+    void crank(uint8_t *stateArr, int *eliteArr, const int eliteSamples) {
+        const bool negate = ++iteration % 10 == 0;
+        const bool unnegate = !negate && negated;
+        negated = negate;
+
+        SNIFFLE_MARK(mark);
+        const size_t slabStride = binOffset.back();
+        if (!negate) {
+            // amplify by sampling from the elite group - BREATHE IN
+#pragma omp parallel for schedule(static)
+            for (int s = 0; s < Slabs; s++) {
+                uint8_t *slab = delta + s * slabStride;
+                for (int i = eliteSamples * s / Slabs; i < eliteSamples * (s + 1) / Slabs; i++) {
+                    const uint8_t *elite = stateArr + (size_t) eliteArr[i] * StateSize;
+                    for (int k = 0; k < FieldCount(); k++)
+                        amplifyDelta(slab + binOffset[k], bin(elite, k), Bins(k), fields[k].categorical);
+                }
+            }
+        }
+
+        SNIFFLE_SPLIT(instrument, Amplify, mark);
+
+        // update and recalc, a field at a time - BREATHE OUT, then merge
+#pragma omp parallel for
+        for (int k = 0; k < FieldCount(); k++) {
+            uint8_t *d = GetDistr(k);
+            const uint n = Bins(k);
+            if (negate)
+                negateBytes(d, n);
+            else
+                updateChannel(d, delta + binOffset[k], slabStride, Slabs, unnegate, n);
+
+            uint sum;
+            channelRange(d, chMin[k], chMax[k], n);
+            const uint8_t min = chMin[k];
+            const uint drift = channelDrift(d, min, dBuilt + binOffset[k], sum, n);
+            if (drift * RebuildDrift > dArea[k]) {
+                uint8_t work[256];
+                dArea[k] = sum - n * min;
+                GetSampler(k).build(d, min, (double) dArea[k], work);
+                channelSnapshot(dBuilt + binOffset[k], d, min, n);
+                chEntropy[k] = channelEntropy(dBuilt + binOffset[k], dArea[k], n);
+                SNIFFLE_COUNT(instrument, rebuilds);
+            }
+        }
+        SNIFFLE_SPLIT(instrument, Update, mark);
+    }
+
+    void reset() {
+        iteration = 0;
+        negated = false;
+
+        const uint bins = binOffset.back();
+        memset(distr, UINT8_MAX >> 2, bins); // a uniform distribution
+        memset(delta, 0, (size_t) Slabs * bins);
+        memset(dBuilt, 0, bins);
+        memset(dArea, 0, FieldCount() * sizeof(uint32_t));
+        memset(chMin, UINT8_MAX >> 2, FieldCount());
+        memset(chMax, UINT8_MAX >> 2, FieldCount());
+
+        for (int k = 0; k < FieldCount(); k++) {
+            GetSampler(k).uniform(); // a uniform distribution
+            chEntropy[k] = 1;
+        }
+    }
+
+    // tables live in the arena, only the iteration state needs checkpointing
+    void save(FILE *fp) {
+        checkpointWrite(fp, &iteration, sizeof(iteration));
+        checkpointWrite(fp, &negated, sizeof(negated));
+    }
+
+    void restore(FILE *fp) {
+        checkpointRead(fp, &iteration, sizeof(iteration));
+        checkpointRead(fp, &negated, sizeof(negated));
+    }
+
+    // as above, for copying an analyser whose tables have been copied as arena bytes
+    void copyState(const FieldAnalyser &other) {
+        iteration = other.iteration;
+        negated = other.negated;
+    }
+
+    // identifies the analyser and its schema in a checkpoint, as the arena layout depends on both
+    uint32_t checkpointTag() const {
+        uint32_t h = 2166136261u ^ 'FELD'; // fnv-1a
+        for (const BitField &f : fields) {
+            const uint32_t w[] = {f.bitOffset, f.bits, f.categorical};
+            for (uint32_t v : w) h = (h ^ v) * 16777619u;
+        }
+        return h;
+    }
+
+    void samplefield(uint8_t *p, int k, Taus88& fnRand) {
+        const uint low = fields[k].bits - ModelBits(k);
+        uint val = GetSampler(k).sample(fnRand) << low;
+        if (low) val |= fnRand() & ((1u << low) - 1);
+        setBits(p, fields[k].bitOffset, fields[k].bits, val);
+    }
+
+    // jump-mutates a field, rather than a byte
+    void mutatebyte(uint8_t *p, Taus88& fnRand) {
+        samplefield(p, fnRand.bounded(FieldCount()), fnRand);
+    }
+
+    void randomize(uint8_t *p, Taus88& fnRand) {
+        if (!covered) {
+            for (int ss = 0; ss < StateSize; ss++) p[ss] = fnRand();
+        }
+        for (int k = 0; k < FieldCount(); k++) {
+            samplefield(p, k, fnRand);
         }
     }
 };
@@ -155,16 +464,33 @@ struct ByteAnalyser {
 //////////////////////////////////
 
 // The null-analyser performs no analysis of the state population.
-template<typename StateType>
 struct NullAnalyser {
-    const static int StateSize = sizeof(StateType);
+    uint StateSize;
 
-    void crank(StateType *stateArr, int *eliteArr, const int eliteSamples) { }
+#if defined(SNIFFLE_INSTRUMENT)
+    Instrument *instrument = 0;
+#endif
+
+    void layout(Arena &arena, uint stateSize) { StateSize = stateSize; }
+
+    void crank(uint8_t *stateArr, int *eliteArr, const int eliteSamples) { }
+
+    float_t calcSmallestChannelDifference() { return 0; }
+
+    float_t calcEntropy() { return 1; }
 
     void reset() {}
 
+    void save(FILE *fp) {}
+
+    void restore(FILE *fp) {}
+
+    void copyState(const NullAnalyser &other) {}
+
+    uint32_t checkpointTag() const { return 'NULL'; }
+
     void mutatebyte(uint8_t *p, Taus88& fnRand) {
-        int byte = fnRand() % StateSize;
+        int byte = fnRand.bounded(StateSize);
         p[byte] = fnRand();
     }
 
@@ -177,40 +503,203 @@ struct NullAnalyser {
 
 //////////////////////////////////
 
-template<typename StateType, uint Population, template <typename ST> typename StateAnalyser>
-struct Maximizer {
-    const static int StateSize = sizeof(StateType);
+// Per-generation fitness statistics. The population is reduced in fixed-size blocks which
+// are merged in order, so the result does not depend on the thread count.
+struct FitnessStats {
+    const static int BlockSize = 4096;
+
+    float_t max, min;
+    int imax, imin; // first index of max and min
+    uint nmax;      // count of max
+    double sum, sumsq;
+
+    void calc(const float_t *f, const int begin, const int end) {
+        float_t mx = f[begin], mn = f[begin];
+        double s = 0, ss = 0;
+#pragma omp simd reduction(max:mx) reduction(min:mn) reduction(+:s,ss)
+        for (int i = begin; i < end; i++) {
+            mx = std::max(mx, f[i]);
+            mn = std::min(mn, f[i]);
+            s += f[i];
+            ss += (double) f[i] * f[i];
+        }
+
+        // the block is still in cache for the index search
+        max = mx;
+        min = mn;
+        sum = s;
+        sumsq = ss;
+        imax = imin = -1;
+        nmax = 0;
+        for (int i = begin; i < end; i++) {
+            if (f[i] == mx) {
+                if (imax < 0) imax = i;
+                nmax++;
+            }
+            if (imin < 0 && f[i] == mn) imin = i;
+        }
+    }
+
+    void merge(const FitnessStats &o) {
+        if (o.max > max) {
+            max = o.max;
+            imax = o.imax;
+            nmax = o.nmax;
+        } else if (o.max == max) {
+            nmax += o.nmax;
+        }
+        if (o.min < min) {
+            min = o.min;
+            imin = o.imin;
+        }
+        sum += o.sum;
+        sumsq += o.sumsq;
+    }
+
+    double mean(uint n) const { return sum / n; }
+
+    double stddev(uint n) const { return sqrt(std::max(0., sumsq / n - mean(n) * mean(n))); }
+};
+
+// Convergence of the solver as of the last crank, for cheap termination tests.
+struct ConvergenceStats {
+    uint64_t generation;
+    float_t best, mean, stddev; // fitness of the cranked population
+    float_t signalNoise;        // smallest channel difference, near 1 when every channel has a clear peak
+    float_t entropy;            // mean normalized channel entropy, 1 is uniform
+    uint stagnation;            // cranks since best improved
+
+    void reset() {
+        generation = 0;
+        best = -HUGE_VALF;
+        mean = stddev = 0;
+        signalNoise = 0;
+        entropy = 1;
+        stagnation = 0;
+    }
+};
+
+//////////////////////////////////
+
+// The runtime-sized maximizer. The population size and the state byte-length are given at
+// construction and all population, fitness, sampler and analyser buffers are carved from one
+// cache-line aligned arena on the heap.
+template<typename StateAnalyser = ByteAnalyser>
+struct DynamicMaximizer {
+    const uint Population;
+    const uint StateSize;
 
-    const static int Group2End = Population * .30;
-    const static int Group3End = Population * .50;
-    const static int Group4End = Population * .70;
-    const static int Group5End = Population * .80;
-    const static int Group6End = Population * .90;
+    const uint Group2End;
+    const uint Group3End;
+    const uint Group4End;
+    const uint Group5End;
+    const uint Group6End;
 
-    const static int EliteSamples = 5 + Group3End * .05;
-    int eliteSamples[EliteSamples];
+    const uint EliteSamples;
+    int *eliteSamples;
 
     int pa, pb;
 
-    StateType state[2][Population];
+    uint8_t *state[2]; // [Population][StateSize]
 
-    float_t e[Population];
-    uint16_t eSampler[65535];
-    uint16_t eSamplerN;
+    float_t *e; // fitness of the current population, see evaluate()
+    FitnessStats fStats; // of the last crank, before clobbering
+    ConvergenceStats convergence;
+    FitnessStats *fBlocks;
+    AliasTable<uint32_t> eSampler;
+    uint32_t *eWork; // [Population], sampler build scratch
 
-    StateAnalyser<StateType> stateAnalyser;
+    StateAnalyser stateAnalyser;
     Taus88State taus88State;
+    Arena arena;
+    size_t analyserBegin; // the analyser's tables are the tail of the arena, from here
+
+#if defined(SNIFFLE_INSTRUMENT)
+    Instrument instrument;
+
+    Instrument *instrumented() { return &instrument; }
+#endif
+
+    // When seeded, every individual draws from its own counter-based stream, keyed by
+    // the seed, generation, phase and index. Runs are then repeatable at any thread count.
+    // Each reset() steps the key, so successive solves from one seed differ.
+    enum Phase { RandomizePhase = 1, ElitePhase, BreedPhase };
+    bool deterministic;
+    uint64_t seedKey;
+    uint64_t generation;
 
-    uint8_t *GetByteArr(StateType &state) { return (uint8_t *) &state; }
+    uint8_t *GetStateArr() { return state[pa]; }
 
-    StateType *GetStateArr() { return &(state[pa][0]); }
+    uint8_t *newPop(int i = 0) { return state[pb] + (size_t) i * StateSize; }
 
-    uint8_t *newPop(int i = 0) { return GetByteArr(state[pb][i]); }
+    uint8_t *oldPop(int i = 0) { return state[pa] + (size_t) i * StateSize; }
 
-    uint8_t *oldPop(int i = 0) { return GetByteArr(state[pa][i]); }
+    // the analyser is copied from the prototype before layout, so it can carry configuration (a field schema, say)
+    DynamicMaximizer(uint population, uint stateSize, const StateAnalyser &prototype = StateAnalyser()) :
+        Population(population), StateSize(stateSize),
+        Group2End(population * .30), Group3End(population * .50), Group4End(population * .70),
+        Group5End(population * .80), Group6End(population * .90),
+        EliteSamples(5 + Group3End * .05),
+        stateAnalyser(prototype),
+        deterministic(false), seedKey(0), generation(0),
+        backAnalyser(prototype)
+    {
+        if (Population < 10 || Population > INT32_MAX || StateSize == 0)
+            throw new std::runtime_error("unsupported population or state size");
+
+        Arena sizing;
+        layout(sizing);
+        arena.reserve(sizing.used);
+        layout(arena);
 
-    Maximizer() {
         taus88State.seed();
+
+#if defined(SNIFFLE_INSTRUMENT)
+        stateAnalyser.instrument = &instrument;
+        backAnalyser.instrument = &instrument;
+        instrument.clear();
+#endif
+    }
+
+    void layout(Arena &a) {
+        state[0] = a.alloc<uint8_t>((size_t) Population * StateSize);
+        state[1] = a.alloc<uint8_t>((size_t) Population * StateSize);
+        e = a.alloc<float_t>(Population);
+        fBlocks = a.alloc<FitnessStats>(BlockCount());
+        eSampler.layout(a, Population);
+        eWork = a.alloc<uint32_t>(Population);
+        eliteSamples = a.alloc<int>(EliteSamples);
+        analyserBegin = a.used;
+        stateAnalyser.layout(a, StateSize);
+    }
+
+    void seed(uint64_t s) {
+        deterministic = true;
+        seedKey = s;
+        taus88State.seed(s);
+    }
+
+    uint64_t streamKey(Phase phase, int i) const {
+        return Taus88State::mix64(seedKey ^ Taus88State::mix64(generation ^ Taus88State::mix64(((uint64_t) phase << 32) | (uint32_t) i)));
+    }
+
+    void rekey(Taus88 &taus88, Phase phase, int i) const {
+        if (deterministic) taus88.rekey(streamKey(phase, i));
+    }
+
+    int BlockCount() const { return (Population + FitnessStats::BlockSize - 1) / FitnessStats::BlockSize; }
+
+    // reduce the population's fitness into fStats, in parallel
+    void calcFitnessStats(const float_t *f) {
+        const int blocks = BlockCount();
+#pragma omp parallel for
+        for (int k = 0; k < blocks; k++) {
+            const int begin = k * FitnessStats::BlockSize;
+            fBlocks[k].calc(f, begin, std::min(begin + FitnessStats::BlockSize, (int) Population));
+        }
+        fStats = fBlocks[0];
+        for (int k = 1; k < blocks; k++)
+            fStats.merge(fBlocks[k]);
     }
 
     void dumpStats() {
@@ -225,36 +714,149 @@ struct Maximizer {
     void reset(int preserve = 0) {
         pa = 0;
         pb = 1;
+        generation = 0;
+        if (deterministic) seedKey = Taus88State::mix64(seedKey);
         stateAnalyser.reset();
+        convergence.reset();
 
 #pragma omp parallel
         {
             Taus88 taus88(taus88State);
 #pragma omp for
             for (int i = preserve; i < Population; i++) {
+                rekey(taus88, RandomizePhase, i);
                 stateAnalyser.randomize(oldPop(i), taus88);
             }
         }
     }
 
+    // Runs the fitness function over the current population in a parallel region.
+    // The function is called as fn(uint8_t*) and the results are kept in e[] for crank().
+    template<typename Fn>
+    float_t *evaluate(Fn fn) {
+        SNIFFLE_MARK(mark);
+#pragma omp parallel for
+        for (int i = 0; i < Population; i++)
+            e[i] = fn(oldPop(i));
+        SNIFFLE_SPLIT(instrumented(), Evaluate, mark);
+        return e;
+    }
+
+    // As above, but each thread owns a default-constructed Scratch object which is
+    // passed as working storage: fn(uint8_t*, Scratch&).
+    template<typename Scratch, typename Fn>
+    float_t *evaluate(Fn fn) {
+        SNIFFLE_MARK(mark);
+#pragma omp parallel
+        {
+            Scratch scratch;
+#pragma omp for
+            for (int i = 0; i < Population; i++)
+                e[i] = fn(oldPop(i), scratch);
+        }
+        SNIFFLE_SPLIT(instrumented(), Evaluate, mark);
+        return e;
+    }
+
+    // As above, but the fitness function is given up to Batch consecutive states at once, to evaluate
+    // them together: fn(const uint8_t *states, int count, float_t *f, Scratch&), where states holds
+    // count states of StateSize bytes each and their fitnesses go to f[0] .. f[count - 1].
+    template<typename Scratch, uint Batch, typename Fn>
+    float_t *evaluateBatch(Fn fn) {
+        SNIFFLE_MARK(mark);
+        const int batches = (int) ((Population + Batch - 1) / Batch);
+#pragma omp parallel
+        {
+            Scratch scratch;
+#pragma omp for
+            for (int b = 0; b < batches; b++) {
+                const int i = b * (int) Batch;
+                fn((const uint8_t *) oldPop(i), std::min((int) Batch, (int) Population - i), e + i, scratch);
+            }
+        }
+        SNIFFLE_SPLIT(instrumented(), Evaluate, mark);
+        return e;
+    }
+
+    // A basic solver-loop: evaluate, test for termination and crank.
+    // The terminator is called as terminator(iteration, f) and returns true to stop.
+    // Returns the iteration count at termination.
+    template<typename Fn, typename Terminator>
+    uint solve(Fn fn, Terminator terminator) {
+        uint iteration = 0;
+        while (!terminator(iteration, evaluate(fn))) {
+            crank();
+            iteration++;
+        }
+        return iteration;
+    }
+
+    template<typename Scratch, typename Fn, typename Terminator>
+    uint solve(Fn fn, Terminator terminator) {
+        uint iteration = 0;
+        while (!terminator(iteration, evaluate<Scratch>(fn))) {
+            crank();
+            iteration++;
+        }
+        return iteration;
+    }
+
+    /////////////////////////////
+    // migration, see islands.h
+
+    // Indices of the (up to) n fittest of the last evaluate(), best first. Returns the count.
+    int fittest(int *idx, int n) const {
+        n = std::min(n, (int) Population);
+        if (n <= 0) return 0;
+        int k = 0;
+        for (int i = 0; i < Population; i++) {
+            if (k == n && !(e[i] > e[idx[n - 1]])) continue;
+            int j = k < n ? k++ : n - 1;
+            for (; j > 0 && e[idx[j - 1]] < e[i]; j--) idx[j] = idx[j - 1];
+            idx[j] = i;
+        }
+        return k;
+    }
+
+    // Replaces the weakest of the current population (never the carried-over best at 0) with an
+    // immigrant and its fitness, so the next crank can breed from it. Returns false, and leaves
+    // the population alone, if the immigrant is no better than the weakest.
+    bool immigrate(const uint8_t *s, float_t f) {
+        int w = 1;
+        for (int i = 2; i < Population; i++)
+            if (e[i] < e[w]) w = i;
+        if (!(f > e[w])) return false;
+        memcpy(oldPop(w), s, StateSize);
+        e[w] = f;
+        return true;
+    }
+
+    // crank using the results of the last evaluate()
+    void crank() { crank(e); }
+
     void crank(float *f) {
 #if 0
         dumpStats();
 #endif
+        SNIFFLE_MARK(mark);
 
-        // find max, and clobber it to prevent saturation
-        int imax = 0;
-        int imin = 0;
-        for (int i = 1; i < Population; i++) {
-            if (f[i] > f[imax]) imax = i;
-            if (f[i] < f[imin]) imin = i;
-        }
+        // find max and min in one fused pass
+        calcFitnessStats(f);
+        const int imax = fStats.imax;
+        const float_t fmax = fStats.max, fmin = fStats.min;
+
+        // clobber the max to prevent saturation (f[0] is exempt)
+#pragma omp parallel for
         for (int i = 1; i < Population; i++) {
-            if (f[i] == f[imax]) f[i] = f[imin];
+            if (f[i] == fmax) f[i] = fmin;
         }
+        SNIFFLE_SPLIT(instrumented(), Stats, mark);
 
-        // calc sampler table
-        eSamplerN = buildSamplerTable<uint16_t, 65535, float_t, Population>(eSampler, f);
+        // calc sampler table, with the area adjusted for the clobbering
+        const uint clobbered = fStats.nmax - (f[0] == fmax ? 1 : 0);
+        const double area = fStats.sum - (double) Population * fmin - (double) clobbered * ((double) fmax - fmin);
+        eSampler.build(f, fmin, area, eWork);
+        SNIFFLE_SPLIT(instrumented(), Sampler, mark);
 
         // sample elites
         eliteSamples[0] = imax; // add best only once to prevent saturation
@@ -262,65 +864,452 @@ struct Maximizer {
         {
             Taus88 taus88(taus88State);
 #pragma omp for
-            for (int i = 1; i < EliteSamples; i++)
-                eliteSamples[i] = eSampler[ taus88() % eSamplerN ];
+            for (int i = 1; i < EliteSamples; i++) {
+                rekey(taus88, ElitePhase, i);
+                eliteSamples[i] = eSampler.sample(taus88);
+            }
         }
+        SNIFFLE_SPLIT(instrumented(), Elite, mark);
 
-        stateAnalyser.crank(GetStateArr(), eliteSamples, EliteSamples);
+        stateAnalyser.crank(GetStateArr(), eliteSamples, EliteSamples); // times its own amplify and update too
+        SNIFFLE_SPLIT(instrumented(), Analyser, mark);
 
         /////////////////////////////
         // build next generation
 
         memcpy(newPop(0), oldPop(imax), (uint) StateSize);
+        SNIFFLE_GROUP(instrumented(), 0, mark);
 
 #pragma omp parallel
         {
             Taus88 taus88(taus88State);
-            NSelector<2> nselector( eSamplerN );
+            NSelector<2> nselector( Population );
+            SNIFFLE_MARK(groupMark);
 
 #pragma omp for nowait
             for (int i = 1; i < Group2End; i++) {
                 // g2: preserve elites
-                int p = eSampler[ taus88() % eSamplerN ];
+                rekey(taus88, BreedPhase, i);
+                int p = eSampler.sample(taus88);
                 memcpy(newPop(i), oldPop(p), (uint) StateSize);
             }
+            SNIFFLE_GROUP(instrumented(), 1, groupMark);
 #pragma omp for nowait
-            for (int i = Group2End +1; i < Group3End; i++) {
+            for (int i = Group2End; i < Group3End; i++) {
                 // g3: semi-preserve elites
-                int p = eSampler[ taus88() % eSamplerN ];
+                rekey(taus88, BreedPhase, i);
+                int p = eSampler.sample(taus88);
                 memcpy(newPop(i), oldPop(p), (uint) StateSize);
                 stateAnalyser.mutatebyte(newPop(i), taus88);
             }
+            SNIFFLE_GROUP(instrumented(), 2, groupMark);
 #pragma omp for nowait
-            for (int i = Group3End +1; i < Group4End; i++) {
+            for (int i = Group3End; i < Group4End; i++) {
                 // g4: some favourables are spliced with best
-                int b = eSampler[ taus88() % eSamplerN ];
-                splice<StateSize>(newPop(i), oldPop(0), oldPop(b), (uint) taus88());
+                rekey(taus88, BreedPhase, i);
+                int b = eSampler.sample(taus88);
+                splice(newPop(i), oldPop(0), oldPop(b), StateSize, (uint) taus88());
             }
+            SNIFFLE_GROUP(instrumented(), 3, groupMark);
 #pragma omp for nowait
-            for (int i = Group4End +1; i < Group5End; i++) {
+            for (int i = Group4End; i < Group5End; i++) {
                 // g5: some favourables are spliced with best (other way)
-                int a = eSampler[ taus88() % eSamplerN ];
-                splice<StateSize>(newPop(i), oldPop(a), oldPop(0), (uint) taus88());
+                rekey(taus88, BreedPhase, i);
+                int a = eSampler.sample(taus88);
+                splice(newPop(i), oldPop(a), oldPop(0), StateSize, (uint) taus88());
             }
+            SNIFFLE_GROUP(instrumented(), 4, groupMark);
 #pragma omp for nowait
-            for (int i = Group5End +1; i < Group6End; i++) {
+            for (int i = Group5End; i < Group6End; i++) {
                 nselector.reset();
                 // g6: favourables that are only spliced
-                int a = eSampler[ nselector.select(taus88) ];
-                int b = eSampler[ nselector.select(taus88) ];
-                splice<StateSize>(newPop(i), oldPop(a), oldPop(b), (uint) taus88());
+                rekey(taus88, BreedPhase, i);
+                int a = nselector.select(taus88, eSampler);
+                int b = nselector.select(taus88, eSampler);
+                splice(newPop(i), oldPop(a), oldPop(b), StateSize, (uint) taus88());
             }
+            SNIFFLE_GROUP(instrumented(), 5, groupMark);
 #pragma omp for nowait
-            for (int i = Group6End +1; i < Population; i++) {
+            for (int i = Group6End; i < Population; i++) {
                 // g7: randomize rest using byteAnalyser
+                rekey(taus88, BreedPhase, i);
                 stateAnalyser.randomize(newPop(i), taus88);
             }
+            SNIFFLE_GROUP(instrumented(), 6, groupMark);
         }
 
+        SNIFFLE_SPLIT(instrumented(), Groups, mark);
+
         std::swap(pa, pb);
+        generation++;
+
+        updateConvergence();
+        SNIFFLE_END(instrumented(), generation);
+    }
+
+    // from fStats and the analyser, at the end of a generation
+    void updateConvergence() {
+        if (fStats.max > convergence.best) {
+            convergence.best = fStats.max;
+            convergence.stagnation = 0;
+        } else {
+            convergence.stagnation++;
+        }
+        convergence.generation = generation;
+        convergence.mean = fStats.mean(Population);
+        convergence.stddev = fStats.stddev(Population);
+        convergence.signalNoise = stateAnalyser.calcSmallestChannelDifference();
+        convergence.entropy = stateAnalyser.calcEntropy();
+    }
+
+    /////////////////////////////
+    // steady-state evolution
+    //
+    // For fitness functions whose cost varies, so a generation waits on its slowest evaluation.
+    // Each worker repeatedly breeds an offspring, evaluates it and inserts it; breeding and
+    // insertion are brief and serialized, evaluations run concurrently and no worker waits for
+    // another's. The best is kept at 0. Every SteadyInterval insertions (a population's worth unless
+    // set) the fitness sampler and the analyser are refreshed, the generation is counted and the
+    // terminator is called. Insertion order depends on timing, so seeded steady runs don't repeat.
+    //
+    // A refresh is built by one worker outside the lock, from a snapshot of the population, into a
+    // second sampler and analyser. They are published by swapping them with the live ones, so the
+    // lock is only held for the snapshot and the swap.
+
+    uint SteadyInterval = 0;
+
+    StateAnalyser backAnalyser;
+    AliasTable<uint32_t> backSampler;
+    float_t *backF;        // [Population], the snapshot's fitness. its states are in newPop()
+    bool backLive = false; // the live sampler and analyser are the ones laid out in backArena
+    Arena backArena;       // the analyser's tables first, laid out as in the arena, so they copy as bytes
+
+    void backLayout(Arena &a) {
+        backAnalyser.layout(a, StateSize);
+        backSampler.layout(a, Population);
+        backF = a.alloc<float_t>(Population);
     }
 
+    // breeds an offspring as a random slot of groups 3-7 would be bred
+    void breed(uint8_t *out, Taus88 &taus88, NSelector<2> &nselector) {
+        const uint i = Group2End + taus88.bounded(Population - Group2End);
+        if (i < Group3End) {
+            memcpy(out, oldPop(eSampler.sample(taus88)), StateSize);
+            stateAnalyser.mutatebyte(out, taus88);
+        } else if (i < Group4End) {
+            splice(out, oldPop(0), oldPop(eSampler.sample(taus88)), StateSize, (uint) taus88());
+        } else if (i < Group5End) {
+            splice(out, oldPop(eSampler.sample(taus88)), oldPop(0), StateSize, (uint) taus88());
+        } else if (i < Group6End) {
+            nselector.reset();
+            int a = nselector.select(taus88, eSampler);
+            int b = nselector.select(taus88, eSampler);
+            splice(out, oldPop(a), oldPop(b), StateSize, (uint) taus88());
+        } else {
+            stateAnalyser.randomize(out, taus88);
+        }
+    }
+
+    // An offspring replaces the loser of a random 4-way tournament, whether or not it's better,
+    // so a converged population still takes in explorers (as generations take in group 7).
+    // One that beats the best takes slot 0 and the best replaces the loser instead. Copies of
+    // the best are dropped, or they would soon be the whole population.
+    void insert(const uint8_t *s, float_t f, Taus88 &taus88) {
+        if (f == e[0] && memcmp(s, oldPop(0), StateSize) == 0) return;
+        int loser = 1 + taus88.bounded(Population - 1);
+        for (int k = 0; k < 3; k++) {
+            int j = 1 + taus88.bounded(Population - 1);
+            if (e[j] < e[loser]) loser = j;
+        }
+        if (f > e[0]) {
+            memcpy(oldPop(loser), oldPop(0), StateSize);
+            e[loser] = e[0];
+            memcpy(oldPop(0), s, StateSize);
+            e[0] = f;
+        } else {
+            memcpy(oldPop(loser), s, StateSize);
+            e[loser] = f;
+        }
+    }
+
+    // takes the population to refresh from, under the lock
+    void snapshot() {
+        memcpy(newPop(0), oldPop(0), (size_t) Population * StateSize);
+        memcpy(backF, e, Population * sizeof(float_t));
+    }
+
+    // the fitness sampler (without the best, as in crank) and the analyser, from the snapshot and
+    // into the back buffers. outside the lock, as only inserts and breeding go on meanwhile.
+    void rebuild(Taus88 &taus88) {
+        calcFitnessStats(backF);
+        const float_t fbest = backF[0], fmin = fStats.min;
+        backF[0] = fmin;
+        backSampler.build(backF, fmin, fStats.sum - (double) Population * fmin - ((double) fbest - fmin), eWork);
+
+        eliteSamples[0] = 0;
+        for (int i = 1; i < EliteSamples; i++)
+            eliteSamples[i] = backSampler.sample(taus88);
+        memcpy(backAnalyserTables(), liveAnalyserTables(), arena.used - analyserBegin);
+        backAnalyser.copyState(stateAnalyser);
+        backAnalyser.crank(newPop(0), eliteSamples, EliteSamples);
+    }
+
+    // swaps the back buffers in, under the lock
+    void publish() {
+        std::swap(eSampler, backSampler);
+        std::swap(stateAnalyser, backAnalyser);
+        backLive = !backLive;
+        generation++;
+        updateConvergence();
+    }
+
+    uint8_t *liveAnalyserTables() { return backLive ? backArena.base : arena.base + analyserBegin; }
+
+    uint8_t *backAnalyserTables() { return backLive ? arena.base + analyserBegin : backArena.base; }
+
+    // leaves the live sampler and analyser in the arena, where crank and checkpoints expect them
+    void settle() {
+        if (!backLive) return;
+        memcpy(backSampler.prob, eSampler.prob, Population * sizeof(float_t));
+        memcpy(backSampler.alias, eSampler.alias, Population * sizeof(uint32_t));
+        memcpy(backAnalyserTables(), liveAnalyserTables(), arena.used - analyserBegin);
+        backAnalyser.copyState(stateAnalyser);
+        std::swap(eSampler, backSampler);
+        std::swap(stateAnalyser, backAnalyser);
+        backLive = false;
+    }
+
+    // The steady-state solver-loop, after a reset(). The terminator is called as
+    // terminator(generation, f) at each refresh and returns true to stop. Returns the evaluations made.
+    template<typename Fn, typename Terminator>
+    uint64_t solveSteady(Fn fn, Terminator terminator) {
+        struct NoScratch {};
+        return solveSteady<NoScratch>([&fn](uint8_t *p, NoScratch &) { return fn(p); }, terminator);
+    }
+
+    template<typename Scratch, typename Fn, typename Terminator>
+    uint64_t solveSteady(Fn fn, Terminator terminator) {
+        if (!backArena.base) {
+            Arena sizing;
+            backLayout(sizing);
+            backArena.reserve(sizing.used);
+            backLayout(backArena);
+        }
+
+        evaluate<Scratch>(fn);
+        calcFitnessStats(e);
+        if (fStats.imax != 0) {
+            std::swap_ranges(oldPop(0), oldPop(0) + StateSize, oldPop(fStats.imax));
+            std::swap(e[0], e[fStats.imax]);
+        }
+
+        uint64_t evaluations = Population, inserted = 0;
+        const uint64_t interval = SteadyInterval ? SteadyInterval : Population;
+        uint64_t nextRefresh = interval;
+        bool stop, refreshing = false;
+        {
+            Taus88 taus88(taus88State);
+            snapshot();
+            rebuild(taus88);
+            publish();
+            stop = terminator((uint) generation, e);
+        }
+
+#pragma omp parallel
+        {
+            Taus88 taus88(taus88State);
+            NSelector<2> nselector(Population);
+            Scratch scratch;
+            std::vector<uint8_t> child(StateSize);
+            float_t f = 0;
+            bool bred = false, done = false, building = false;
+
+            while (!done) {
+#pragma omp critical(sniffle_steady)
+                {
+                    if (bred && !stop) {
+                        insert(child.data(), f, taus88);
+                        evaluations++;
+                        if (++inserted >= nextRefresh && !refreshing) {
+                            nextRefresh = inserted + interval;
+                            snapshot();
+                            refreshing = building = true;
+                        }
+                    }
+                    done = stop;
+                    if (!done) breed(child.data(), taus88, nselector);
+                    bred = true;
+                }
+                if (building) {
+                    rebuild(taus88);
+#pragma omp critical(sniffle_steady)
+                    {
+                        publish();
+                        if (!stop) stop = terminator((uint) generation, e);
+                        refreshing = building = false;
+                        done = stop;
+                    }
+                }
+                if (!done) f = fn(child.data(), scratch);
+            }
+        }
+        settle();
+        return evaluations;
+    }
+
+    /////////////////////////////
+    // checkpointing
+
+    struct CheckpointHeader {
+        char magic[8];
+        uint32_t version, population, stateSize, lanes;
+        uint32_t analyser;    // StateAnalyser::checkpointTag()
+        uint32_t stride;      // Taus88State::Stride, the words per saved PRNG slot
+        uint32_t statsBytes;  // sizeof(ConvergenceStats), saved raw
+        uint64_t arenaBytes;
+        int32_t pa, threads;
+        uint64_t deterministic, seedKey, generation;
+    };
+
+    CheckpointHeader header() const {
+        CheckpointHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, "SNIFFLE", 8);
+        h.version = 3;
+        h.population = Population;
+        h.stateSize = StateSize;
+        h.lanes = Taus88Lanes;
+        h.analyser = stateAnalyser.checkpointTag();
+        h.stride = Taus88State::Stride;
+        h.statsBytes = sizeof(ConvergenceStats);
+        h.arenaBytes = arena.used;
+        h.pa = pa;
+        h.threads = taus88State.threads;
+        h.deterministic = deterministic;
+        h.seedKey = seedKey;
+        h.generation = generation;
+        return h;
+    }
+
+    // Writes the whole solver: the arena (both populations, fitness, samplers and analyser
+    // distributions), the analyser's iteration state, the convergence stats and the PRNG state.
+    void save(FILE *fp) {
+        CheckpointHeader h = header();
+        checkpointWrite(fp, &h, sizeof(h));
+        checkpointWrite(fp, arena.base, arena.used);
+        stateAnalyser.save(fp);
+        checkpointWrite(fp, &convergence, sizeof(convergence));
+        checkpointWrite(fp, taus88State.block, (size_t) taus88State.threads * Taus88State::Stride * sizeof(uint32_t));
+    }
+
+    // Restores into a maximizer of the same population, state size, analyser (and schema) and
+    // PRNG lanes, from a build with the same layout; anything else is rejected.
+    // PRNG slots for threads that were not saved are reseeded from the seed.
+    void restore(FILE *fp) {
+        CheckpointHeader h, mine = header();
+        checkpointRead(fp, &h, sizeof(h));
+        if (memcmp(h.magic, mine.magic, 8) || h.version != mine.version || h.population != mine.population ||
+            h.stateSize != mine.stateSize || h.lanes != mine.lanes || h.analyser != mine.analyser ||
+            h.stride != mine.stride || h.statsBytes != mine.statsBytes || h.arenaBytes != mine.arenaBytes)
+            throw new std::runtime_error("checkpoint does not match solver");
+
+        pa = h.pa;
+        pb = 1 - pa;
+        deterministic = h.deterministic != 0;
+        seedKey = h.seedKey;
+        generation = h.generation;
+        checkpointRead(fp, arena.base, arena.used);
+        stateAnalyser.restore(fp);
+        checkpointRead(fp, &convergence, sizeof(convergence));
+
+        const size_t slotBytes = Taus88State::Stride * sizeof(uint32_t);
+        for (int t = 0; t < h.threads; t++) {
+            uint32_t slot[Taus88State::Stride];
+            checkpointRead(fp, slot, slotBytes);
+            if (t < taus88State.threads) memcpy(taus88State.slot(t), slot, slotBytes);
+        }
+        for (int t = h.threads; t < taus88State.threads; t++) {
+            uint64_t key = Taus88State::mix64(seedKey ^ generation ^ (uint64_t) t);
+            Taus88State::seedStreams(taus88State.slot(t), key);
+        }
+    }
+
+    // path versions. saving goes through a temporary file so an interrupted save leaves the last checkpoint.
+    void save(const char *path) {
+        std::string tmp = std::string(path) + ".tmp";
+        FILE *fp = fopen(tmp.c_str(), "wb");
+        if (!fp) throw new std::runtime_error("checkpoint open failed");
+        save(fp);
+        if (fclose(fp) != 0 || rename(tmp.c_str(), path) != 0)
+            throw new std::runtime_error("checkpoint save failed");
+    }
+
+    void restore(const char *path) {
+        FILE *fp = fopen(path, "rb");
+        if (!fp) throw new std::runtime_error("checkpoint open failed");
+        restore(fp);
+        fclose(fp);
+    }
+
+};
+
+//////////////////////////////////
+
+// The compile-time typed maximizer: a view of the runtime-sized maximizer for a fixed StateType.
+template<typename StateType, uint Population, typename StateAnalyser = ByteAnalyser>
+struct Maximizer : DynamicMaximizer<StateAnalyser> {
+    typedef DynamicMaximizer<StateAnalyser> Base;
+
+    Maximizer(const StateAnalyser &prototype = StateAnalyser()) : Base(Population, sizeof(StateType), prototype) {}
+
+    StateType *GetStateArr() { return (StateType *) Base::GetStateArr(); }
+
+    // fn(StateType&)
+    template<typename Fn>
+    float_t *evaluate(Fn fn) {
+        return Base::evaluate(typed(fn));
+    }
+
+    // fn(StateType&, Scratch&)
+    template<typename Scratch, typename Fn>
+    float_t *evaluate(Fn fn) {
+        return Base::template evaluate<Scratch>(typed(fn));
+    }
+
+    template<typename Fn, typename Terminator>
+    uint solve(Fn fn, Terminator terminator) {
+        return Base::solve(typed(fn), terminator);
+    }
+
+    template<typename Scratch, typename Fn, typename Terminator>
+    uint solve(Fn fn, Terminator terminator) {
+        return Base::template solve<Scratch>(typed(fn), terminator);
+    }
+
+    template<typename Fn, typename Terminator>
+    uint64_t solveSteady(Fn fn, Terminator terminator) {
+        return Base::solveSteady(typed(fn), terminator);
+    }
+
+    template<typename Scratch, typename Fn, typename Terminator>
+    uint64_t solveSteady(Fn fn, Terminator terminator) {
+        return Base::template solveSteady<Scratch>(typed(fn), terminator);
+    }
+
+private:
+    // adapts a typed fitness function to the byte-array signature
+    template<typename Fn>
+    struct TypedFn {
+        Fn fn;
+
+        float_t operator()(uint8_t *p) { return fn(*(StateType *) p); }
+
+        template<typename Scratch>
+        float_t operator()(uint8_t *p, Scratch &scratch) { return fn(*(StateType *) p, scratch); }
+    };
+
+    template<typename Fn>
+    static TypedFn<Fn> typed(Fn fn) { return TypedFn<Fn>{fn}; }
 };
 
 }
@@ -3,25 +3,81 @@
 //
 // Splices two byte arrays of the same length together at the specified bit.
 // When splicing, bits from a will be written to lower memory than bits from b.
-// In the transition byte, high bits come from a and high bits come from b. Does it matter?
+// In the transition byte, high bits come from a and low bits come from b. Does it matter?
+//
+// Whole bytes either side of the transition are block-copied, so only the transition byte is merged.
+// Multi-point and uniform crossover variants follow the same bit order: a 'stream' runs from
+// low to high memory and, within a byte, from high to low bits.
 
 #ifndef PROJECT_SPLICE_H
 #define PROJECT_SPLICE_H
 
+#include <cstdint>
+#include <cstring>
+
 namespace util {
 
+inline void splice(uint8_t *out, const uint8_t *a, const uint8_t *b, const uint Size, uint uRand) {
+    uint uBit = ((uint64_t) uRand * (Size * 8)) >> 32; // multiply-shift, uRand is uniform over 32 bits
+    uint i = uBit / 8;
+    const uint8_t mask = (uint8_t) ((1u << (uBit & 7)) - 1);
+    memcpy(out, a, i);
+    out[i] = (a[i] & ~mask) | (b[i] & mask);
+    memcpy(out + i + 1, b + i + 1, Size - i - 1);
+}
+
 template<uint Size>
-void splice(uint8_t *out, uint8_t *a, uint8_t *b, uint uRand) {
-    const uint8_t u8Mask[] = {
-        0b00000000, 0b00000001, 0b00000011, 0b00000111,
-        0b00001111, 0b00011111, 0b00111111, 0b01111111
-    };
-
-    uint uBit = uRand % ( Size * 8 );
-    int i = 0;
-    while (i < (uBit / 8)) out[i++] = a[i];
-    out[i++] = (a[i] & ~u8Mask[uBit & 7]) | (b[i] & u8Mask[uBit & 7]);
-    while (i < Size) out[i++] = b[i];
+void splice(uint8_t *out, const uint8_t *a, const uint8_t *b, uint uRand) {
+    splice(out, a, b, Size, uRand);
+}
+
+// copies stream bits [s0,s1) of src into out
+inline void copyStream(uint8_t *out, const uint8_t *src, const uint s0, const uint s1) {
+    if (s0 >= s1) return;
+    uint i0 = s0 / 8, i1 = s1 / 8;
+    const uint8_t head = (uint8_t) (0xFF >> (s0 & 7));   // stream bits at or after s0
+    const uint8_t tail = (uint8_t) ~(0xFF >> (s1 & 7));  // stream bits before s1
+    if (i0 == i1) {
+        const uint8_t mask = head & tail;
+        out[i0] = (out[i0] & ~mask) | (src[i0] & mask);
+        return;
+    }
+    out[i0] = (out[i0] & ~head) | (src[i0] & head);
+    memcpy(out + i0 + 1, src + i0 + 1, i1 - i0 - 1);
+    if (tail) out[i1] = (out[i1] & ~tail) | (src[i1] & tail);
+}
+
+// Points-point crossover: the source alternates between a and b at each random cut.
+template<uint Points, typename Rand>
+void spliceMulti(uint8_t *out, const uint8_t *a, const uint8_t *b, const uint Size, Rand &fnRand) {
+    uint cut[Points];
+    for (uint k = 0; k < Points; k++) {
+        // insertion sort, Points is small
+        uint c = fnRand.bounded(Size * 8 + 1), j = k;
+        for (; j > 0 && cut[j - 1] > c; j--) cut[j] = cut[j - 1];
+        cut[j] = c;
+    }
+    memcpy(out, a, Size);
+    for (uint k = 0; k < Points; k += 2)
+        copyStream(out, b, cut[k], k + 1 < Points ? cut[k + 1] : Size * 8);
+}
+
+// Uniform crossover: each bit comes from a or b according to a random bitmask, a word at a time.
+template<typename Rand>
+void crossover(uint8_t *out, const uint8_t *a, const uint8_t *b, const uint Size, Rand &fnRand) {
+    uint i = 0;
+    for (; i + 8 <= Size; i += 8) {
+        uint64_t wa, wb, m = ((uint64_t) fnRand() << 32) | fnRand();
+        memcpy(&wa, a + i, 8);
+        memcpy(&wb, b + i, 8);
+        wa = (wa & ~m) | (wb & m);
+        memcpy(out + i, &wa, 8);
+    }
+    if (i < Size) {
+        uint64_t m = ((uint64_t) fnRand() << 32) | fnRand();
+        for (; i < Size; i++, m >>= 8)
+            out[i] = (a[i] & ~(uint8_t) m) | (b[i] & (uint8_t) m);
+    }
 }
 
 }
@@ -0,0 +1,102 @@
+// copyright 2016 john howard (orthopteroid@gmail.com)
+// MIT license
+//
+// A bounded single-producer single-consumer ring of fixed-size records, lock-free.
+// Records are written and read in place: the producer claims a slot, fills it and publishes it,
+// the consumer takes the front slot, reads it and releases it. Nothing blocks or allocates after
+// construction; a claim on a full ring and a front of an empty ring return null.
+//
+// The ring can own its block or be laid over a caller's block (bytesFor() long), such as shared
+// memory, in which case its counters are only initialized when asked.
+//
+//   if (uint8_t *r = ring.claim()) { memcpy(r, data, ring.RecordBytes); ring.publish(); }
+//   while (uint8_t *r = ring.front()) { use(r); ring.release(); }
+
+#ifndef PSYCHICSNIFFLE_SPSCRING_H
+#define PSYCHICSNIFFLE_SPSCRING_H
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+
+#include "arena.h"
+
+namespace util {
+
+struct SpscRing
+{
+    // the consumer's and producer's counters are on their own cache lines
+    struct Counters {
+        std::atomic<uint64_t> head; // next record to read, advanced by the consumer
+        uint8_t headPad[CacheLine - sizeof(std::atomic<uint64_t>)];
+        std::atomic<uint64_t> tail; // next record to write, advanced by the producer
+        uint8_t tailPad[CacheLine - sizeof(std::atomic<uint64_t>)];
+
+        Counters() : head(0), tail(0) {}
+    };
+
+    const size_t RecordBytes;
+    const uint64_t Mask;
+    Counters *c;
+    uint8_t *slots;
+    bool owned;
+
+    SpscRing( const SpscRing& other ) = delete;
+    SpscRing& operator=( SpscRing& other ) = delete;
+    SpscRing& operator=( const SpscRing& other ) = delete;
+
+    static uint64_t capacityFor(uint64_t n)
+    {
+        uint64_t c = 2;
+        while (c < n) c <<= 1;
+        return c;
+    }
+
+    static size_t bytesFor(size_t recordBytes, uint64_t capacity)
+    {
+        return sizeof(Counters) + recordBytes * capacityFor(capacity);
+    }
+
+    // capacity is rounded up to a power of two
+    SpscRing(size_t recordBytes, uint64_t capacity) :
+        RecordBytes(recordBytes), Mask(capacityFor(capacity) - 1), owned(true)
+    {
+        uint8_t *block = (uint8_t *) alignedAlloc(bytesFor(recordBytes, capacity));
+        c = new(block) Counters();
+        slots = block + sizeof(Counters);
+    }
+
+    // over a cache-line aligned block of bytesFor() bytes
+    SpscRing(size_t recordBytes, uint64_t capacity, void *block, bool init) :
+        RecordBytes(recordBytes), Mask(capacityFor(capacity) - 1), owned(false)
+    {
+        c = init ? new(block) Counters() : (Counters *) block;
+        slots = (uint8_t *) block + sizeof(Counters);
+    }
+
+    virtual ~SpscRing() { if (owned) alignedFree(c); }
+
+    // producer side
+    uint8_t *claim()
+    {
+        const uint64_t t = c->tail.load(std::memory_order_relaxed);
+        if (t - c->head.load(std::memory_order_acquire) > Mask) return 0;
+        return slots + (t & Mask) * RecordBytes;
+    }
+
+    void publish() { c->tail.store(c->tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    // consumer side
+    uint8_t *front()
+    {
+        const uint64_t h = c->head.load(std::memory_order_relaxed);
+        if (h == c->tail.load(std::memory_order_acquire)) return 0;
+        return slots + (h & Mask) * RecordBytes;
+    }
+
+    void release() { c->head.store(c->head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+};
+
+}
+
+#endif //PSYCHICSNIFFLE_SPSCRING_H
@@ -3,71 +3,130 @@
 //
 // Homebrew OpenMP threadsafe Tausme88 PRNG
 // http://www.iro.umontreal.ca/~lecuyer/myftp/papers/tausme.ps
+//
+// Each thread advances Lanes independent streams in lockstep (8 with AVX2, 4 with SSE2 or scalar)
+// and draws are served from a small block buffer.
 
 #ifndef PSYCHICSNIFFLE_TAUS88_H
 #define PSYCHICSNIFFLE_TAUS88_H
 
 #include <omp.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "arena.h"
 
 namespace util {
 
+#if defined(__AVX2__)
+const int Taus88Lanes = 8;
+#else
+const int Taus88Lanes = 4;
+#endif
+
 /*
 // instance only one of these in the main application thread:
 Taus88State taus88State; // declare omp state
 srand(int(time(NULL))); // seed the single-thread state
 taus88State.seed(); // seed the omp state from the single-thread state
+// or, for repeatable streams:
+taus88State.seed(12345ULL); // split a 64 bit seed into per-thread seeds
 */
 struct Taus88State
 {
+    // each thread's streams are stored as s0[Lanes], s1[Lanes], s2[Lanes],
+    // padded out to their own cache lines
+    const static int Words = 3 * Taus88Lanes;
+    const static int Stride = ((Words * sizeof(uint32_t) + CacheLine - 1) / CacheLine) * CacheLine / sizeof(uint32_t);
+
     uint32_t *block = 0;
+    int threads = 0; // sized at construction, so set omp thread counts beforehand
 
     Taus88State( const Taus88State& other ) = delete;
     Taus88State& operator=( Taus88State& other ) = delete;
     Taus88State& operator=( const Taus88State& other ) = delete;
 
 #ifdef _OPENMP
-    int ompMaxThreads() { return omp_get_max_threads(); }
+    int ompMaxThreads() { return std::max(omp_get_max_threads(), omp_get_num_procs()); }
     int ompThreadNum() { return omp_get_thread_num(); }
 #else
     int ompMaxThreads() { return 1; }
-    int ompThreadNum() { return 1; }
+    int ompThreadNum() { return 0; }
 #endif
 
+    // a thread past the count the block was sized for has no slot, as when the omp thread
+    // count was raised after construction
+    uint32_t *slot( int t )
+    {
+        if( t >= threads ) throw new std::runtime_error("more omp threads than Taus88State was sized for");
+        return block + t * Stride;
+    }
+
     void copyOut( uint32_t* stale )
     {
-        int m = ompMaxThreads();
-        int t = ompThreadNum();
-        stale[0] = block[t*m+0];
-        stale[1] = block[t*m+1];
-        stale[2] = block[t*m+2];
-        stale[3] = block[t*m+3];
+        memcpy( stale, slot( ompThreadNum() ), Words * sizeof(uint32_t) );
     }
 
     void copyIn( uint32_t* dirty )
     {
-        int m = ompMaxThreads();
-        int t = ompThreadNum();
-        block[t*m+0] = dirty[0];
-        block[t*m+1] = dirty[1];
-        block[t*m+2] = dirty[2];
-        block[t*m+3] = dirty[3];
+        memcpy( slot( ompThreadNum() ), dirty, Words * sizeof(uint32_t) );
+    }
+
+    // http://xoshiro.di.unimi.it/splitmix64.c
+    static uint64_t splitmix64( uint64_t& x )
+    {
+        uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    // a stateless 64 bit mix, for deriving stream keys from counters
+    static uint64_t mix64( uint64_t z )
+    {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    // seed a thread's streams, respecting the taus88 minimums (s0 > 1, s1 > 7, s2 > 15)
+    static void seedStreams( uint32_t* state, uint64_t& x )
+    {
+        const uint32_t minimum[] = { 2, 8, 16 };
+        for( int lane=0; lane<Taus88Lanes; lane++ )
+            for( int k=0; k<3; k++ )
+            {
+                uint32_t w = (uint32_t)splitmix64( x );
+                state[k * Taus88Lanes + lane] = w < minimum[k] ? w + minimum[k] : w;
+            }
+    }
+
+    // split seeds: the per-thread streams are derived from one 64 bit seed
+    void seed( uint64_t s )
+    {
+        for( int t=0; t<threads; t++ )
+            seedStreams( slot( t ), s );
     }
 
     void seed()
     {
-        int m = ompMaxThreads();
-        for( int i=0; i<m*4; i++ )
-            block[i] = ((uint32_t)rand() << 8) + (uint32_t)rand(); // 32 bits please
+        uint64_t s = ((uint64_t)rand() << 40) ^ ((uint64_t)rand() << 20) ^ (uint64_t)rand(); // 64 bits please
+        seed( s );
     }
 
     Taus88State()
     {
-        int m = ompMaxThreads();
-        block = new uint32_t[m*4];
+        threads = ompMaxThreads();
+        block = (uint32_t*)alignedAlloc( threads * Stride * sizeof(uint32_t) );
+        memset( block, 0, threads * Stride * sizeof(uint32_t) );
     }
     virtual ~Taus88State()
     {
-        delete[] block;
+        alignedFree( block );
     }
 };
 
@@ -82,8 +141,14 @@ struct Taus88State
  */
 struct Taus88
 {
+    const static int Lanes = Taus88Lanes;
+    const static int Steps = 4;
+    const static int BlockSize = Lanes * Steps; // values generated per refill
+
     Taus88State& master;
-    uint32_t state[4];
+    uint32_t state[Taus88State::Words]; // s0[Lanes], s1[Lanes], s2[Lanes]
+    uint32_t block[BlockSize];
+    int next;
 
     // uncopyable and unassignable
     Taus88() = delete;
@@ -92,27 +157,126 @@ struct Taus88
     Taus88& operator=( const Taus88& other ) = delete;
 
     // initialize local state from master block
-    Taus88( Taus88State &master_ ) : master(master_)
+    Taus88( Taus88State &master_ ) : master(master_), next(BlockSize)
     {
         master.copyOut(state);
     }
 
-    // restore local state to master block
+    // counter-based streams: reseed all lanes from a key, independent of the thread
+    void rekey( uint64_t key )
+    {
+        Taus88State::seedStreams( state, key );
+        next = BlockSize;
+    }
+
+    // restore local state to master block. unused values in the block are discarded.
     virtual ~Taus88()
     {
         master.copyIn(state);
     }
 
-    // permute local state each time () is called
+    // serve from the block, refilling when empty
     uint32_t operator()()
     {
-        state[3] = (((state[0] << 13) ^ state[0]) >> 19);
-        state[0] = (((state[0] & 0xFFFFFFFE) << 12) ^ state[3]);
-        state[3] = (((state[1] << 2) ^ state[1]) >> 25);
-        state[1] = (((state[1] & 0xFFFFFFF8) << 4) ^ state[3]);
-        state[3] = (((state[2] << 3) ^ state[2]) >> 11);
-        state[2] = (((state[2] & 0xFFFFFFF0) << 17) ^ state[3]);
-        return state[0] ^ state[1] ^ state[2];
+        if( next == BlockSize ) refill();
+        return block[next++];
+    }
+
+    // unbiased draw from [0,n) by multiply-shift, without a division in the common case
+    // https://arxiv.org/abs/1805.10941 (Lemire, nearly divisionless)
+    uint32_t bounded( uint32_t n )
+    {
+        uint64_t m = (uint64_t)(*this)() * n;
+        uint32_t l = (uint32_t)m;
+        if( l < n )
+        {
+            const uint32_t t = (uint32_t)(-n) % n;
+            while( l < t )
+            {
+                m = (uint64_t)(*this)() * n;
+                l = (uint32_t)m;
+            }
+        }
+        return (uint32_t)(m >> 32);
+    }
+
+    // bulk draws
+    void fill( uint32_t* out, int n )
+    {
+        while( n > 0 )
+        {
+            if( next == BlockSize ) refill();
+            int k = std::min( n, BlockSize - next );
+            memcpy( out, block + next, k * sizeof(uint32_t) );
+            next += k;
+            out += k;
+            n -= k;
+        }
+    }
+
+    // permute all lanes Steps times, storing each step's output
+    void refill()
+    {
+        uint32_t *s0 = state, *s1 = state + Lanes, *s2 = state + 2 * Lanes;
+#if defined(__AVX2__)
+        __m256i a = _mm256_loadu_si256( (__m256i*)s0 );
+        __m256i b = _mm256_loadu_si256( (__m256i*)s1 );
+        __m256i c = _mm256_loadu_si256( (__m256i*)s2 );
+        const __m256i ma = _mm256_set1_epi32( 0xFFFFFFFE );
+        const __m256i mb = _mm256_set1_epi32( 0xFFFFFFF8 );
+        const __m256i mc = _mm256_set1_epi32( 0xFFFFFFF0 );
+        for( int t=0; t<Steps; t++ )
+        {
+            __m256i x;
+            x = _mm256_srli_epi32( _mm256_xor_si256( _mm256_slli_epi32( a, 13 ), a ), 19 );
+            a = _mm256_xor_si256( _mm256_slli_epi32( _mm256_and_si256( a, ma ), 12 ), x );
+            x = _mm256_srli_epi32( _mm256_xor_si256( _mm256_slli_epi32( b, 2 ), b ), 25 );
+            b = _mm256_xor_si256( _mm256_slli_epi32( _mm256_and_si256( b, mb ), 4 ), x );
+            x = _mm256_srli_epi32( _mm256_xor_si256( _mm256_slli_epi32( c, 3 ), c ), 11 );
+            c = _mm256_xor_si256( _mm256_slli_epi32( _mm256_and_si256( c, mc ), 17 ), x );
+            _mm256_storeu_si256( (__m256i*)(block + t * Lanes), _mm256_xor_si256( _mm256_xor_si256( a, b ), c ) );
+        }
+        _mm256_storeu_si256( (__m256i*)s0, a );
+        _mm256_storeu_si256( (__m256i*)s1, b );
+        _mm256_storeu_si256( (__m256i*)s2, c );
+#elif defined(__SSE2__)
+        __m128i a = _mm_loadu_si128( (__m128i*)s0 );
+        __m128i b = _mm_loadu_si128( (__m128i*)s1 );
+        __m128i c = _mm_loadu_si128( (__m128i*)s2 );
+        const __m128i ma = _mm_set1_epi32( 0xFFFFFFFE );
+        const __m128i mb = _mm_set1_epi32( 0xFFFFFFF8 );
+        const __m128i mc = _mm_set1_epi32( 0xFFFFFFF0 );
+        for( int t=0; t<Steps; t++ )
+        {
+            __m128i x;
+            x = _mm_srli_epi32( _mm_xor_si128( _mm_slli_epi32( a, 13 ), a ), 19 );
+            a = _mm_xor_si128( _mm_slli_epi32( _mm_and_si128( a, ma ), 12 ), x );
+            x = _mm_srli_epi32( _mm_xor_si128( _mm_slli_epi32( b, 2 ), b ), 25 );
+            b = _mm_xor_si128( _mm_slli_epi32( _mm_and_si128( b, mb ), 4 ), x );
+            x = _mm_srli_epi32( _mm_xor_si128( _mm_slli_epi32( c, 3 ), c ), 11 );
+            c = _mm_xor_si128( _mm_slli_epi32( _mm_and_si128( c, mc ), 17 ), x );
+            _mm_storeu_si128( (__m128i*)(block + t * Lanes), _mm_xor_si128( _mm_xor_si128( a, b ), c ) );
+        }
+        _mm_storeu_si128( (__m128i*)s0, a );
+        _mm_storeu_si128( (__m128i*)s1, b );
+        _mm_storeu_si128( (__m128i*)s2, c );
+#else
+        for( int t=0; t<Steps; t++ )
+        {
+            for( int l=0; l<Lanes; l++ )
+            {
+                uint32_t x;
+                x = (((s0[l] << 13) ^ s0[l]) >> 19);
+                s0[l] = (((s0[l] & 0xFFFFFFFE) << 12) ^ x);
+                x = (((s1[l] << 2) ^ s1[l]) >> 25);
+                s1[l] = (((s1[l] & 0xFFFFFFF8) << 4) ^ x);
+                x = (((s2[l] << 3) ^ s2[l]) >> 11);
+                s2[l] = (((s2[l] & 0xFFFFFFF0) << 17) ^ x);
+                block[t * Lanes + l] = s0[l] ^ s1[l] ^ s2[l];
+            }
+        }
+#endif
+        next = 0;
     }
 };
 
@@ -0,0 +1,396 @@
+// copyright 2016 john howard (orthopteroid@gmail.com)
+// MIT license
+//
+// Migrant transports: how islands in separate threads, processes or hosts pass individuals.
+// A migrant is its fitness followed by its state bytes. States are POD so nothing is encoded:
+// sockets write straight from the population with one sendmsg and rings are filled in place.
+// Sends and receives never block. A send that can't complete now returns false and the migrant
+// is dropped, and a receive returns false when no whole migrant is waiting. A peer that goes away
+// just stops sending and receiving, so processes can finish independently.
+//
+// Transports are opened from a spec:
+//   unix:/tmp/river.sock          connect to a unix-domain socket
+//   listen:unix:/tmp/river.sock   accept one peer on a unix-domain socket
+//   tcp:host:port                 connect over tcp (127.0.0.1 is fine for testing)
+//   listen:tcp:port               accept one peer over tcp
+//   shm:/out-name,/in-name        a shared-memory ring each way (either name may be empty)
+// Sockets carry migrants both ways. Listeners accept lazily, on first use, and connections are
+// retried for a while, so processes can start in any order.
+
+#ifndef PSYCHICSNIFFLE_TRANSPORT_H
+#define PSYCHICSNIFFLE_TRANSPORT_H
+
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "spscring.h"
+
+namespace util {
+
+struct Transport
+{
+    const size_t StateSize;
+    const size_t RecordBytes;
+
+    Transport(size_t stateSize) : StateSize(stateSize), RecordBytes(sizeof(float_t) + stateSize) {}
+    Transport( const Transport& other ) = delete;
+    Transport& operator=( const Transport& other ) = delete;
+
+    virtual ~Transport() {}
+
+    virtual bool send(float_t f, const uint8_t *state) = 0;
+    virtual bool receive(float_t &f, uint8_t *state) = 0;
+};
+
+//////////////////////////////
+
+// between threads of one process. one thread sends and one receives.
+struct RingTransport : Transport
+{
+    SpscRing ring;
+
+    RingTransport(size_t stateSize, uint64_t capacity) : Transport(stateSize), ring(RecordBytes, capacity) {}
+
+    bool send(float_t f, const uint8_t *state) {
+        uint8_t *r = ring.claim();
+        if (!r) return false;
+        memcpy(r, &f, sizeof(f));
+        memcpy(r + sizeof(f), state, StateSize);
+        ring.publish();
+        return true;
+    }
+
+    bool receive(float_t &f, uint8_t *state) {
+        uint8_t *r = ring.front();
+        if (!r) return false;
+        memcpy(&f, r, sizeof(f));
+        memcpy(state, r + sizeof(f), StateSize);
+        ring.release();
+        return true;
+    }
+};
+
+//////////////////////////////
+
+// A ring in a named shared-memory segment for each direction, between processes on one host.
+// Whichever process maps a segment first lays out its ring; the other checks the layout matches.
+// Segments outlive the processes; unlink() them once the run is over.
+struct ShmTransport : Transport
+{
+    struct Header {
+        std::atomic<uint32_t> ready; // 0 fresh, 1 being laid out, 2 laid out
+        uint32_t recordBytes;
+        uint64_t capacity;
+        uint8_t pad[CacheLine - sizeof(std::atomic<uint32_t>) - sizeof(uint32_t) - sizeof(uint64_t)];
+    };
+
+    struct Segment {
+        void *map = 0;
+        size_t bytes = 0;
+        std::unique_ptr<SpscRing> ring;
+    };
+
+    Segment out, in;
+
+    ShmTransport(const char *sendName, const char *receiveName, size_t stateSize, uint64_t capacity) :
+        Transport(stateSize)
+    {
+        static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared-memory rings need lock-free 64 bit atomics");
+        if (sendName && *sendName) open(out, sendName, capacity);
+        if (receiveName && *receiveName) open(in, receiveName, capacity);
+    }
+
+    virtual ~ShmTransport() {
+        close(out);
+        close(in);
+    }
+
+    static void unlink(const char *name) { shm_unlink(name); }
+
+    bool send(float_t f, const uint8_t *state) {
+        if (!out.ring) return false;
+        uint8_t *r = out.ring->claim();
+        if (!r) return false;
+        memcpy(r, &f, sizeof(f));
+        memcpy(r + sizeof(f), state, StateSize);
+        out.ring->publish();
+        return true;
+    }
+
+    bool receive(float_t &f, uint8_t *state) {
+        if (!in.ring) return false;
+        uint8_t *r = in.ring->front();
+        if (!r) return false;
+        memcpy(&f, r, sizeof(f));
+        memcpy(state, r + sizeof(f), StateSize);
+        in.ring->release();
+        return true;
+    }
+
+private:
+    void open(Segment &s, const char *name, uint64_t capacity) {
+        s.bytes = sizeof(Header) + SpscRing::bytesFor(RecordBytes, capacity);
+        int fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+        if (fd < 0)
+            throw new std::runtime_error("shm_open failed");
+        struct stat st;
+        if (fstat(fd, &st) != 0 || ((size_t) st.st_size < s.bytes && ftruncate(fd, s.bytes) != 0)) {
+            ::close(fd);
+            throw new std::runtime_error("shared-memory sizing failed");
+        }
+        s.map = mmap(0, s.bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (s.map == MAP_FAILED) {
+            s.map = 0;
+            throw new std::runtime_error("shared-memory mmap failed");
+        }
+
+        Header *h = (Header *) s.map;
+        uint32_t fresh = 0;
+        const bool first = h->ready.compare_exchange_strong(fresh, 1);
+        if (first) {
+            h->recordBytes = (uint32_t) RecordBytes;
+            h->capacity = SpscRing::capacityFor(capacity);
+        } else {
+            while (h->ready.load(std::memory_order_acquire) != 2) sched_yield();
+            if (h->recordBytes != RecordBytes || h->capacity != SpscRing::capacityFor(capacity))
+                throw new std::runtime_error("shared-memory ring does not match");
+        }
+        s.ring.reset(new SpscRing(RecordBytes, capacity, (uint8_t *) s.map + sizeof(Header), first));
+        if (first) h->ready.store(2, std::memory_order_release);
+    }
+
+    static void close(Segment &s) {
+        s.ring.reset();
+        if (s.map) munmap(s.map, s.bytes);
+        s.map = 0;
+    }
+};
+
+//////////////////////////////
+
+// A stream socket, unix-domain or tcp. A record that only partly fits in the socket buffer has
+// its remainder held back and written ahead of the next send.
+struct SocketTransport : Transport
+{
+    int fd;
+    int listener; // until a peer is accepted
+    bool closed;
+
+    std::vector<uint8_t> out, in;
+    size_t outDone, outSize, inFill;
+
+    SocketTransport(int fd_, size_t stateSize, bool listening = false) :
+        Transport(stateSize), fd(listening ? -1 : fd_), listener(listening ? fd_ : -1), closed(false),
+        out(RecordBytes), in(RecordBytes), outDone(0), outSize(0), inFill(0)
+    {}
+
+    virtual ~SocketTransport() {
+        if (fd >= 0) ::close(fd);
+        if (listener >= 0) ::close(listener);
+    }
+
+    bool send(float_t f, const uint8_t *state) {
+        if (!ready() || !flush()) return false;
+
+        iovec iov[2];
+        iov[0].iov_base = &f;
+        iov[0].iov_len = sizeof(f);
+        iov[1].iov_base = (void *) state;
+        iov[1].iov_len = StateSize;
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+
+        ssize_t n = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) return failed();
+        if ((size_t) n < RecordBytes) {
+            memcpy(out.data(), &f, sizeof(f));
+            memcpy(out.data() + sizeof(f), state, StateSize);
+            outDone = (size_t) n;
+            outSize = RecordBytes;
+        }
+        return true;
+    }
+
+    bool receive(float_t &f, uint8_t *state) {
+        if (!ready()) return false;
+        while (inFill < RecordBytes) {
+            ssize_t n = recv(fd, in.data() + inFill, RecordBytes - inFill, MSG_DONTWAIT);
+            if (n == 0) closed = true;
+            if (n <= 0) return n < 0 ? failed() : false;
+            inFill += (size_t) n;
+        }
+        memcpy(&f, in.data(), sizeof(f));
+        memcpy(state, in.data() + sizeof(f), StateSize);
+        inFill = 0;
+        return true;
+    }
+
+private:
+    bool ready() {
+        if (closed) return false;
+        if (fd < 0) {
+            fd = accept(listener, 0, 0);
+            if (fd < 0) return false;
+            ::close(listener);
+            listener = -1;
+            noDelay(fd);
+        }
+        return true;
+    }
+
+    // the held-back remainder, if any. true when there's none left.
+    bool flush() {
+        while (outDone < outSize) {
+            ssize_t n = ::send(fd, out.data() + outDone, outSize - outDone, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n < 0) return failed();
+            outDone += (size_t) n;
+        }
+        outDone = outSize = 0;
+        return true;
+    }
+
+    // false either way, but a peer that has gone is closed for good
+    bool failed() {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) closed = true;
+        return false;
+    }
+
+public:
+    static void noDelay(int fd) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // fails harmlessly on unix sockets
+    }
+
+    static const int ConnectTries = 200; // 10s at 50ms
+
+    static int unixListen(const char *path) {
+        sockaddr_un addr;
+        unixAddress(addr, path);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        ::unlink(path);
+        if (fd < 0 || bind(fd, (sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 1) != 0)
+            throw new std::runtime_error("unix socket listen failed");
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        return fd;
+    }
+
+    static int unixConnect(const char *path) {
+        sockaddr_un addr;
+        unixAddress(addr, path);
+        for (int tries = 0; tries < ConnectTries; tries++) {
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0) break;
+            if (connect(fd, (sockaddr *) &addr, sizeof(addr)) == 0) return fd;
+            ::close(fd);
+            usleep(50000);
+        }
+        throw new std::runtime_error("unix socket connect failed");
+    }
+
+    static int tcpListen(const char *port) {
+        addrinfo hints, *res = 0;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        if (getaddrinfo(0, port, &hints, &res) != 0)
+            throw new std::runtime_error("tcp address failed");
+        int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol), one = 1;
+        if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        const bool ok = fd >= 0 && bind(fd, res->ai_addr, res->ai_addrlen) == 0 && listen(fd, 1) == 0;
+        freeaddrinfo(res);
+        if (!ok)
+            throw new std::runtime_error("tcp listen failed");
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        return fd;
+    }
+
+    static int tcpConnect(const char *host, const char *port) {
+        addrinfo hints, *res = 0;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host, port, &hints, &res) != 0)
+            throw new std::runtime_error("tcp address failed");
+        for (int tries = 0; tries < ConnectTries; tries++) {
+            int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+            if (fd < 0) break;
+            if (connect(fd, res->ai_addr, res->ai_addrlen) == 0) {
+                freeaddrinfo(res);
+                noDelay(fd);
+                return fd;
+            }
+            ::close(fd);
+            usleep(50000);
+        }
+        freeaddrinfo(res);
+        throw new std::runtime_error("tcp connect failed");
+    }
+
+private:
+    static void unixAddress(sockaddr_un &addr, const char *path) {
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(addr.sun_path))
+            throw new std::runtime_error("unix socket path too long");
+        strcpy(addr.sun_path, path);
+    }
+};
+
+//////////////////////////////
+
+// opens a transport from one of the specs above, for migrants of stateSize bytes
+inline std::shared_ptr<Transport> openTransport(const std::string &spec, size_t stateSize, uint64_t capacity = 16)
+{
+    const bool listening = spec.compare(0, 7, "listen:") == 0;
+    const std::string s = listening ? spec.substr(7) : spec;
+    const size_t colon = s.find(':');
+    if (colon == std::string::npos)
+        throw new std::runtime_error("transport spec needs a kind");
+    const std::string kind = s.substr(0, colon), rest = s.substr(colon + 1);
+
+    if (kind == "unix") {
+        int fd = listening ? SocketTransport::unixListen(rest.c_str()) : SocketTransport::unixConnect(rest.c_str());
+        return std::make_shared<SocketTransport>(fd, stateSize, listening);
+    }
+    if (kind == "tcp") {
+        if (listening)
+            return std::make_shared<SocketTransport>(SocketTransport::tcpListen(rest.c_str()), stateSize, true);
+        const size_t port = rest.rfind(':');
+        if (port == std::string::npos)
+            throw new std::runtime_error("tcp spec needs host:port");
+        int fd = SocketTransport::tcpConnect(rest.substr(0, port).c_str(), rest.substr(port + 1).c_str());
+        return std::make_shared<SocketTransport>(fd, stateSize);
+    }
+    if (kind == "shm" && !listening) {
+        const size_t comma = rest.find(',');
+        const std::string sendName = rest.substr(0, comma);
+        const std::string receiveName = comma == std::string::npos ? "" : rest.substr(comma + 1);
+        return std::make_shared<ShmTransport>(sendName.c_str(), receiveName.c_str(), stateSize, capacity);
+    }
+    throw new std::runtime_error("unknown transport spec");
+}
+
+}
+
+#endif //PSYCHICSNIFFLE_TRANSPORT_H